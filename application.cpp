@@ -7,15 +7,22 @@
 #include "tui.h"
 #include "yt.h"
 #include "db.h"
+#include "queries.h"
 #include "subprocess.h"
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <fstream>
+#include <limits>
 
 #include <time.h>
 #include <libgen.h>
@@ -28,25 +35,250 @@ std::string user_home;
 
 std::vector<UserFlag> userFlags;
 std::vector<Channel> channels;
-std::unordered_map<std::string, std::vector<Video>> videos;
+// Index into channels for each channel slot, -1 for slots without a listed channel.
+std::vector<int> channel_index_by_slot;
+// Videos of the selected channel.
+VideoList channel_videos;
+// Sizes of all channels and virtual channels, kept up to date instead of counted on selection.
+VideoCounts video_counts;
+// Flags of all videos, virtual channels are evaluated on it.
+VideoFlagIndex video_flag_index;
 
 size_t selected_channel;
-size_t current_video_count = 0;
 size_t selected_video = 0;
 size_t videos_per_page = 0;
 size_t current_page_count = 0;
 size_t title_offset = 0;
 bool any_title_in_next_half = false;
-bool clear_channels_on_change = false;
 
 static application_host *host = nullptr;
+// Matches channel names for the channel picker, built on first use after the list changed.
+static std::optional<FuzzyMatcher> channel_matcher;
+// Slot of the search channel, which is added on the first search. -1 before.
+static int search_channel_slot = -1;
+// Only set if auto refresh is enabled.
+static std::optional<RefreshSchedule> refresh_schedule;
 
 static termpaint_attr* get_attr(const AttributeSetType type, const bool highlight=false)
 {
     return highlight ? attributes[type].highlight : attributes[type].normal;
 }
 
-void draw_channel_list(const std::vector<Video> &videos, bool show_channel_name=false)
+Channel *channel_by_slot(const int slot)
+{
+    if(slot < 0 || size_t(slot) >= channel_index_by_slot.size() || channel_index_by_slot[slot] < 0)
+        return nullptr;
+    return &channels[channel_index_by_slot[slot]];
+}
+
+// Refreshes run on a worker thread with its own database connection, so the list stays usable
+// meanwhile. Finished jobs are handed back through the results queue and applied by the main loop.
+enum class refresh_notification {
+    None,
+    PerChannel,
+    Summary,
+};
+
+struct refresh_job {
+    std::vector<Channel> channels;
+    refresh_notification notification;
+};
+
+struct refresh_result {
+    refresh_job job;
+    std::vector<int> counts;
+    // Why the refresh of each channel failed, empty for those that worked.
+    std::vector<std::string> errors;
+    // Title of the newest video of each channel with exactly one new video.
+    std::vector<std::string> titles;
+    // A database error that ended the job. Only the main thread can show it.
+    std::string database_error;
+};
+
+static struct refresh_worker_state {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<refresh_job> jobs;
+    std::deque<refresh_result> results;
+    bool stop = false;
+    // Progress of the running job, for the status line.
+    bool busy = false;
+    size_t done = 0;
+    size_t total = 0;
+    // Failed refreshes, set by the main thread from the results. Shown in the status line until
+    // a refresh works again.
+    std::string errors;
+} refresh_worker;
+
+static std::string newest_video_title(sqlite3 *db, const Channel &channel)
+{
+    std::string title;
+    sqlite3_stmt *query;
+    SC(db_prepare(db, newest_video_sql, &query));
+    SC(sqlite3_bind_text(query, 1, channel.id.c_str(), -1, SQLITE_TRANSIENT));
+    if(sqlite3_step(query) == SQLITE_ROW)
+        title = get_string(query, 0);
+    SC(db_release(query));
+    return title;
+}
+
+// The reader is opened by the main thread, so errors opening it can be shown.
+static void refresh_worker_main(sqlite3 *reader)
+{
+    std::unique_lock<std::mutex> lock(refresh_worker.mutex);
+    while(true) {
+        refresh_worker.wakeup.wait(lock, []{ return refresh_worker.stop || !refresh_worker.jobs.empty(); });
+        if(refresh_worker.stop)
+            break;
+
+        refresh_result result;
+        result.job = std::move(refresh_worker.jobs.front());
+        refresh_worker.jobs.pop_front();
+        refresh_worker.busy = true;
+        refresh_worker.done = 0;
+        refresh_worker.total = result.job.channels.size();
+        lock.unlock();
+        tp_wakeup();
+
+        std::vector<const Channel*> to_refresh;
+        for(const Channel &channel: result.job.channels)
+            to_refresh.push_back(&channel);
+        try {
+            result.counts = Channel::fetch_new_videos_parallel(reader, to_refresh, result.errors, [](size_t done, size_t) {
+                std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+                if(refresh_worker.done != done) {
+                    refresh_worker.done = done;
+                    tp_wakeup();
+                }
+                return !refresh_worker.stop;
+            });
+
+            result.titles.resize(result.counts.size());
+            if(result.job.notification == refresh_notification::PerChannel) {
+                for(size_t i = 0; i < result.counts.size(); i++) {
+                    if(result.counts[i] == 1)
+                        result.titles[i] = newest_video_title(reader, result.job.channels[i]);
+                }
+            }
+        } catch(const db_error &err) {
+            result.database_error = err.what();
+        }
+
+        lock.lock();
+        refresh_worker.busy = false;
+        refresh_worker.results.push_back(std::move(result));
+        tp_wakeup();
+    }
+    lock.unlock();
+    db_close_reader(reader);
+}
+
+// Cancels the running job and drops queued ones.
+void stop_refresh_worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+        refresh_worker.stop = true;
+        refresh_worker.jobs.clear();
+        refresh_worker.wakeup.notify_one();
+    }
+    refresh_worker.thread.join();
+}
+
+void start_refresh_worker()
+{
+    refresh_worker.stop = false;
+    refresh_worker.thread = std::thread(refresh_worker_main, db_open_reader());
+    // tui_abort exits without stopping the worker, which must not outlive the state it uses.
+    std::atexit([] {
+        if(refresh_worker.thread.joinable())
+            stop_refresh_worker();
+    });
+}
+
+void queue_refresh(std::vector<Channel> channels, refresh_notification notification)
+{
+    std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+    refresh_worker.jobs.push_back(refresh_job{std::move(channels), notification});
+    refresh_worker.wakeup.notify_one();
+}
+
+bool refresh_running()
+{
+    std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+    return refresh_worker.busy || !refresh_worker.jobs.empty();
+}
+
+std::string refresh_status()
+{
+    std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+    if(!refresh_worker.busy && refresh_worker.jobs.empty())
+        return refresh_worker.errors;
+
+    std::string status = "Refreshing";
+    if(refresh_worker.busy && refresh_worker.total > 1)
+        status.append(" ").append(std::to_string(refresh_worker.done)).append("/").append(std::to_string(refresh_worker.total));
+    status.append("…");
+    if(!refresh_worker.jobs.empty())
+        status.append(" (").append(std::to_string(refresh_worker.jobs.size())).append(" more queued)");
+    return status;
+}
+
+static constexpr size_t date_format_width = sizeof("xxxx-xx-xx xx:xx") - 1;
+
+// Fills in the cached display values, so drawing doesn't need to measure or format anything.
+void prepare_video_for_display(Video &video)
+{
+    video.tui_title_width = string_width(video.title);
+
+    static_assert(sizeof(video.tui_date) == date_format_width + 1);
+    video.tui_date[0] = 0;
+    const time_t timestamp = video.timestamp;
+    struct tm tm;
+    if(timestamp && gmtime_r(&timestamp, &tm))
+        strftime(video.tui_date, sizeof(video.tui_date), "%F %H:%M", &tm);
+}
+
+// What draw_channel_list put on the surface in the previous frame, so rows that didn't change
+// are not drawn again. Anything that affects all rows invalidates the whole list.
+struct list_view_row {
+    VideoId video_id;
+    int flags;
+    bool selected;
+
+    bool operator==(const list_view_row &other) const
+    {
+        return video_id == other.video_id && flags == other.flags && selected == other.selected;
+    }
+};
+
+static struct list_view_state {
+    bool valid = false;
+    unsigned int overlay_generation = 0;
+    size_t cols = 0;
+    size_t rows = 0;
+    std::string header;
+    std::string status;
+    size_t channel_name_width = 0;
+    size_t title_offset = 0;
+    std::vector<std::optional<list_view_row>> rows_drawn;
+} list_view;
+
+static struct frame_statistics {
+    uint64_t frames = 0;
+    uint64_t full_redraws = 0;
+    uint64_t rows_drawn = 0;
+    std::chrono::microseconds total_latency{0};
+    std::chrono::microseconds max_latency{0};
+} frame_stats;
+
+void invalidate_channel_list()
+{
+    list_view.valid = false;
+}
+
+void draw_channel_list(VideoList &videos, bool show_channel_name=false)
 {
     const size_t cols = termpaint_surface_width(surface);
     const size_t rows = termpaint_surface_height(surface);
@@ -54,33 +286,23 @@ void draw_channel_list(const std::vector<Video> &videos, bool show_channel_name=
     const size_t column_spacing = 2;
 
     const size_t date_column = 0;
-    const size_t date_width = std::string("xxxx-xx-xx xx:xx").size();
+    const size_t date_width = date_format_width;
 
     const size_t start_row = 2;
     const size_t available_rows = rows - 2;
     videos_per_page = available_rows;
-    const int cur_page = selected_video / available_rows;
-    const int pages = videos.size() / available_rows;
-
-    size_t cur_entry = 0;
-
-    std::map<std::string, std::string> channel_name_lookup;
+    const size_t cur_page = selected_video / available_rows;
+    const size_t pages = videos.size() / available_rows;
+    const size_t first_entry = cur_page * available_rows;
+    videos.load(first_entry, available_rows);
+    const size_t last_entry = std::min(videos.size(), first_entry + available_rows);
 
     const size_t channel_name_column = date_column + date_width + column_spacing;
     size_t channel_name_width = show_channel_name * std::string("Channel").size();
     if(show_channel_name) {
-        for(size_t i = cur_page*available_rows; i < videos.size(); i++) {
-            const Video &video = videos.at(i);
-            for(size_t c = 0; c<channels.size(); c++) {
-                const Channel &channel = channels.at(c);
-                if(video.channel_id == channel.id) {
-                    channel_name_lookup[channel.id] = channel.name;
-                    channel_name_width = std::max(channel_name_width, channel.tui_name_width);
-                    break;
-                }
-            }
-            if(++cur_entry > available_rows)
-                break;
+        for(size_t i = first_entry; i < last_entry; i++) {
+            if(const Channel *channel = channel_by_slot(videos.at(i).channel_slot))
+                channel_name_width = std::max(channel_name_width, channel->tui_name_width);
         }
     }
 
@@ -88,54 +310,93 @@ void draw_channel_list(const std::vector<Video> &videos, bool show_channel_name=
     const size_t last_name_column = cols;
     const size_t name_quater = (last_name_column - first_name_column) / 4;
 
-    const std::string channel_name = std::string("Channel: ") + channels[selected_channel].name;
-    termpaint_surface_write_with_attr(surface, 0, 0, channel_name.c_str(), get_attr(ASNormal));
+    std::string channel_name = std::string("Channel: ") + channels[selected_channel].name;
+    if(channels[selected_channel].search)
+        channel_name += " \"" + *channels[selected_channel].search + "\"";
+    std::string page_text;
+    if(pages > 1)
+        page_text = "(Page " + std::to_string(cur_page + 1) + "/" + std::to_string(pages + 1) + ")";
+
+    const std::string header = channel_name + "\n" + page_text;
+    const bool full_redraw = !list_view.valid || list_view.overlay_generation != overlay_generation
+            || list_view.cols != cols || list_view.rows != rows || list_view.header != header
+            || list_view.channel_name_width != channel_name_width || list_view.title_offset != title_offset;
+
+    if(full_redraw) {
+        termpaint_surface_clear(surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+
+        termpaint_surface_write_with_attr(surface, 0, 0, channel_name.c_str(), get_attr(ASNormal));
+        if(!page_text.empty()) {
+            const size_t w = string_width(page_text);
+            termpaint_surface_write_with_attr(surface, cols - w, 0, page_text.c_str(), attributes[ASNormal].normal);
+        }
 
-    if(pages > 1) {
-        std::string text = "(Page " + std::to_string(cur_page + 1) + "/" + std::to_string(pages + 1) + ")";
-        const size_t w = string_width(text);
-        termpaint_surface_write_with_attr(surface, cols - w, 0, text.c_str(), attributes[ASNormal].normal);
+        list_view.valid = true;
+        list_view.overlay_generation = overlay_generation;
+        list_view.cols = cols;
+        list_view.rows = rows;
+        list_view.header = header;
+        list_view.channel_name_width = channel_name_width;
+        list_view.title_offset = title_offset;
+        list_view.rows_drawn.assign(available_rows, std::nullopt);
+        frame_stats.full_redraws++;
     }
 
-    termpaint_surface_write_with_attr(surface, date_column, 1, "Date", get_attr(ASNormal));
-    if(show_channel_name)
-        termpaint_surface_write_with_attr(surface, channel_name_column, 1, "Channel", get_attr(ASNormal));
-    termpaint_surface_write_with_attr(surface, first_name_column, 1, "Title", get_attr(ASNormal));
+    // The column headers share their row with the status of background refreshes.
+    const std::string status = refresh_status();
+    if(full_redraw || list_view.status != status) {
+        termpaint_surface_clear_rect(surface, 0, 1, cols, 1, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        termpaint_surface_write_with_attr(surface, date_column, 1, "Date", get_attr(ASNormal));
+        if(show_channel_name)
+            termpaint_surface_write_with_attr(surface, channel_name_column, 1, "Channel", get_attr(ASNormal));
+        termpaint_surface_write_with_attr(surface, first_name_column, 1, "Title", get_attr(ASNormal));
+        if(!status.empty()) {
+            const size_t w = string_width(status);
+            termpaint_surface_write_with_attr(surface, cols > w ? cols - w : 0, 1, status.c_str(), get_attr(ASNormal));
+        }
+        list_view.status = status;
+    }
 
     any_title_in_next_half = false;
 
-    cur_entry = 0;
-    for(size_t i = cur_page*available_rows; i < videos.size(); i++) {
-        const size_t row = start_row + cur_entry;
-        const bool selected = i == selected_video;
-        const Video &video = videos.at(i);
-        termpaint_attr *attr = get_attr(video.flags & kWatched ? ASWatched : ASUnwatched, selected);
+    for(size_t entry = 0; entry < available_rows; entry++) {
+        const size_t i = first_entry + entry;
+        const size_t row = start_row + entry;
 
-        termpaint_surface_clear_rect_with_attr(surface, 0, row, cols, 1, attr);
+        std::optional<list_view_row> content;
+        if(i < last_entry) {
+            const Video &video = videos.at(i);
+            content = list_view_row{video.id, video.flags, i == selected_video};
+            any_title_in_next_half = any_title_in_next_half || ((title_offset + 2) * name_quater) < video.tui_title_width;
+        }
 
-        std::vector<char> dt(date_width + 10, 0);
+        std::optional<list_view_row> &drawn = list_view.rows_drawn[entry];
+        if(!full_redraw && drawn == content)
+            continue;
+        drawn = content;
+        frame_stats.rows_drawn++;
 
-        struct tm tm;
-        memset(&tm, 0, sizeof(tm));
-        const std::string &date_str = !video.published.empty() ? video.published : video.added_to_playlist;
-        if(strptime(date_str.c_str(), "%FT%T%z", &tm) != nullptr) {
-            strftime(dt.data(), date_width + 10, "%F %H:%M", &tm);
+        if(!content) {
+            termpaint_surface_clear_rect(surface, 0, row, cols, 1, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+            continue;
         }
 
-        termpaint_surface_write_with_attr(surface, date_column, row, dt.data(), attr);
+        const Video &video = videos.at(i);
+        termpaint_attr *attr = get_attr(video.flags & kWatched ? ASWatched : ASUnwatched, content->selected);
+
+        termpaint_surface_clear_rect_with_attr(surface, 0, row, cols, 1, attr);
+
+        termpaint_surface_write_with_attr(surface, date_column, row, video.tui_date, attr);
         if(show_channel_name) {
-            termpaint_surface_write_with_attr(surface, channel_name_column, row, channel_name_lookup[video.channel_id].c_str(), attr);
+            if(const Channel *channel = channel_by_slot(video.channel_slot))
+                termpaint_surface_write_with_attr(surface, channel_name_column, row, channel->name.c_str(), attr);
         }
 
         bool in_this_quater = title_offset * name_quater < video.tui_title_width;
-        any_title_in_next_half = any_title_in_next_half || ((title_offset + 2) * name_quater) < video.tui_title_width;
         if(in_this_quater)
-            termpaint_surface_write_with_attr_clipped(surface, first_name_column, row, video.title.c_str() + (name_quater * title_offset), attr, first_name_column, last_name_column);
+            termpaint_surface_write_with_attr_clipped(surface, first_name_column, row, video.title.data() + (name_quater * title_offset), attr, first_name_column, last_name_column);
         else
             termpaint_surface_write_with_attr(surface, first_name_column, row, "←", attr);
-
-        if(++cur_entry > available_rows)
-            break;
     }
 
     if(!any_title_in_next_half && title_offset > 0)
@@ -158,48 +419,10 @@ void draw_no_channels_msg()
     }
 }
 
-void load_videos_for_channel(const Channel &channel, bool force=false)
+void reload_channel_videos()
 {
-    if(!force && videos.find(channel.id) != videos.end() && !videos[channel.id].empty())
-        return;
-
-    std::vector<Video> &channelVideos = videos[channel.id];
-    if(channel.is_virtual) {
-        channelVideos = Video::get_all_with_filter(channel.filter);
-    } else {
-        channelVideos = Video::get_all_for_channel(channel.id);
-    }
-
-    for(Video &video: channelVideos) {
-        video.tui_title_width = string_width(video.title);
-    }
-
-    if(channels[selected_channel].id == channel.id)
-        selected_video = 0;
-}
-
-int fetch_videos_for_channel(Channel &channel, bool name_in_title=false)
-{
-    if(channel.is_virtual) {
-        std::vector<Video> &channelVideos = videos[channel.id];
-        channelVideos = Video::get_all_with_filter(channel.filter);
-        for(Video &video: channelVideos) {
-            video.tui_title_width = string_width(video.title);
-        }
-        return 0;
-    }
-
-    std::string title("Refreshing");
-    if(name_in_title)
-        title.append(" ").append(channel.name);
-    title.append("…");
-    progress_info *info = begin_progress(title, 30);
-    const int new_video_count = channel.fetch_new_videos(db, info);
-    end_progress(info);
-    load_videos_for_channel(channels[selected_channel], true);
-    channel.load_info(db);
-
-    return new_video_count;
+    channel_videos.reload();
+    selected_video = 0;
 }
 
 bool startswith(const std::string &str, const std::string &with)
@@ -220,17 +443,9 @@ std::string replace(const std::string &str, const std::string &what, const std::
 }
 
 void select_channel_by_index(const int index) {
-    if(clear_channels_on_change) {
-        for(auto &[k, v]: videos) {
-            v.clear();
-        }
-    }
     selected_channel = index;
-    const Channel &channel = channels.at(selected_channel);
     selected_video = 0;
-    load_videos_for_channel(channel, clear_channels_on_change);
-    current_video_count = videos[channel.id].size();
-    clear_channels_on_change = channel.is_virtual;
+    channel_videos.reset(channels.at(selected_channel));
 }
 
 void select_channel_by_name(const std::string &channel_name) {
@@ -249,30 +464,26 @@ void select_channel_by_id(const std::string &channel_id) {
 
 void add_channel_to_list(Channel &channel)
 {
-    channel.load_info(db);
     channel.tui_name_width = string_width(channel.name);
 
-    std::string selected_channel_id;
+    int selected_slot = -1;
     if(selected_channel < channels.size())
-        selected_channel_id = channels[selected_channel].id;
+        selected_slot = channels[selected_channel].slot;
     channels.push_back(channel);
 
     std::sort(channels.begin(), channels.end(), [](const Channel &a, const Channel &b){ if(a.is_virtual != b.is_virtual) { return a.is_virtual > b.is_virtual; } return a.name < b.name; });
-
-    if(!selected_channel_id.empty()) {
-        const size_t new_index = std::distance(channels.cbegin(), std::find_if(channels.cbegin(), channels.cend(), [&](const Channel &ch){ return ch.id == selected_channel_id; }));
-        selected_channel = new_index;
+    channel_matcher.reset();
+
+    channel_index_by_slot.assign(channel_index_by_slot.size(), -1);
+    for(size_t i = 0; i < channels.size(); i++) {
+        const size_t slot = channels[i].slot;
+        if(slot >= channel_index_by_slot.size())
+            channel_index_by_slot.resize(slot + 1, -1);
+        channel_index_by_slot[slot] = i;
     }
-}
 
-void prepare_virtual_channel(Channel &channel)
-{
-    std::vector<Video> &channelVideos = videos[channel.id];
-    channelVideos = Video::get_all_with_filter(channel.filter);
-    for (Video &video: channelVideos) {
-        video.tui_title_width = string_width(video.title);
-    }
-    add_channel_to_list(channel);
+    if(selected_slot >= 0)
+        selected_channel = channel_index_by_slot[selected_slot];
 }
 
 void add_virtual_channels()
@@ -281,17 +492,17 @@ void add_virtual_channels()
     unwatched_filter.video_mask = kWatched;
     unwatched_filter.video_value = false;
     Channel unwatched_virt_channel = Channel::add_virtual("All Unwatched", unwatched_filter);
-    prepare_virtual_channel(unwatched_virt_channel);
+    add_channel_to_list(unwatched_virt_channel);
     ChannelFilter all_filter;
     all_filter.video_mask = kNone;
     all_filter.video_value = false;
     Channel all_virt_channel = Channel::add_virtual("All", all_filter);
-    prepare_virtual_channel(all_virt_channel);
+    add_channel_to_list(all_virt_channel);
     ChannelFilter watched_filter;
     watched_filter.video_mask = kWatched;
     watched_filter.video_value = true;
     Channel watched_virt_channel = Channel::add_virtual("All Watched", watched_filter);
-    prepare_virtual_channel(watched_virt_channel);
+    add_channel_to_list(watched_virt_channel);
 }
 
 void action_add_channel_by_name()
@@ -307,9 +518,11 @@ void action_add_channel_by_name()
         if(ch.is_valid()) {
             add_channel_to_list(ch);
             select_channel_by_id(ch.id);
+            if(refresh_schedule)
+                refresh_schedule->schedule(ch, 0);
             tp_flush();
             if(message_box("Update now?", "Fetch videos for this channel now?", Button::Yes | Button::No, Button::Yes) == Button::Yes) {
-                fetch_videos_for_channel(ch);
+                queue_refresh({ch}, refresh_notification::None);
             }
         } else {
             message_box("Can't add channel", "There is no channel with this name!");
@@ -330,9 +543,11 @@ void action_add_channel_by_id()
         if(ch.is_valid()) {
             add_channel_to_list(ch);
             select_channel_by_id(ch.id);
+            if(refresh_schedule)
+                refresh_schedule->schedule(ch, 0);
             tp_flush();
             if(message_box("Update now?", "Fetch videos for this channel now?", Button::Yes | Button::No, Button::Yes) == Button::Yes) {
-                fetch_videos_for_channel(ch);
+                queue_refresh({ch}, refresh_notification::None);
             }
         } else {
             message_box("Can't add channel", "There is no channel with this ID!");
@@ -344,16 +559,58 @@ void action_select_channel() {
     if(channels.empty()) {
         message_box("Can't select channel", "No channels configured.\n Please configure one.");
     } else {
-        std::vector<std::string> names;
-        names.reserve(channels.size());
-        for(const Channel &c: channels)
-            names.push_back(c.name + " (" + std::to_string(c.unwatched) + ")");
-        const int channel = get_selection("Switch Channel", names, selected_channel, Align::VCenter | Align::Left);
+        if(!channel_matcher) {
+            std::vector<std::string> names;
+            names.reserve(channels.size());
+            for(const Channel &c: channels)
+                names.push_back(c.name);
+            channel_matcher.emplace(names);
+        }
+        const int channel = fuzzy_select("Switch Channel", *channel_matcher, [](size_t index) {
+            const Channel &c = channels[index];
+            // The matches of a search are only counted when it is shown.
+            if(c.search)
+                return c.name + " \"" + *c.search + "\"";
+            return c.name + " (" + std::to_string(video_counts.count(c, channels, kWatched, 0)) + ")";
+        }, selected_channel, Align::VCenter | Align::Left);
         if(channel != -1)
             select_channel_by_index(channel);
     }
 }
 
+void set_search(const std::string &search)
+{
+    if(search_channel_slot < 0) {
+        Channel channel = Channel::add_search("Search", search);
+        add_channel_to_list(channel);
+        search_channel_slot = channel.slot;
+    }
+    Channel *channel = channel_by_slot(search_channel_slot);
+    channel->search = search;
+    select_channel_by_index(channel_index_by_slot[search_channel_slot]);
+}
+
+// Shows the matches in the search channel while typing. Aborting goes back to the channel that was
+// selected before.
+void action_search() {
+    const int previous_slot = channels.at(selected_channel).slot;
+    std::string previous_search;
+    if(const Channel *channel = search_channel_slot < 0 ? nullptr : channel_by_slot(search_channel_slot))
+        previous_search = *channel->search;
+
+    const std::string search = edit_string("Search", std::string(), previous_search, Align::Bottom | Align::HCenter, [](const std::string &input) {
+        set_search(input);
+        draw_channel_list(channel_videos, true);
+    });
+    if(search.empty()) {
+        if(search_channel_slot >= 0)
+            channel_by_slot(search_channel_slot)->search = previous_search;
+        select_channel_by_index(channel_index_by_slot[previous_slot]);
+    } else if(search != previous_search) {
+        set_search(search);
+    }
+}
+
 bool run_command(const std::vector<std::string> &cmd, const std::vector<std::pair<std::string, std::string>> &placeholders={}) {
     const size_t cmd_size = cmd.size();
 
@@ -388,18 +645,15 @@ std::vector<std::string> notify_channel_new_video_command;
 std::vector<std::string> notify_channel_new_videos_command;
 std::vector<std::string> notify_channels_new_videos_command;
 
-void action_refresh_channel() {
-    Channel &ch = channels.at(selected_channel);
-    const int new_videos = fetch_videos_for_channel(channels.at(selected_channel));
-    if(new_videos == 0 || ch.is_virtual)
-        return;
+static void notify_new_videos(const Channel &ch, const int new_videos, const std::string &title)
+{
     if(new_videos == 1) {
         if(host && host->notify_channel_single_video) {
-            host->notify_channel_single_video(ch.name, videos[ch.id].front().title);
+            host->notify_channel_single_video(ch.name, title);
         } else if(!notify_channel_new_video_command.empty()) {
             run_command(notify_channel_new_video_command, {
                             {"{{channelName}}", ch.name},
-                            {"{{videoTitle}}", videos[ch.id].front().title},
+                            {"{{videoTitle}}", title},
                         });
         }
     } else {
@@ -414,19 +668,8 @@ void action_refresh_channel() {
     }
 }
 
-void action_refresh_all_channels(bool ask=true) {
-    if(ask && message_box("Refresh all channels?", "Do you want to refresh all " + std::to_string(channels.size()) + " channels?", Button::Yes | Button::No, Button::No) != Button::Yes)
-        return;
-    int updated_channels = 0;
-    int new_videos = 0;
-    for(Channel &channel: channels) {
-        const int count = fetch_videos_for_channel(channel, true);
-        if(channel.is_virtual)
-            continue;
-        new_videos += count;
-        if(count)
-            updated_channels++;
-    }
+static void notify_new_videos(const int updated_channels, const int new_videos)
+{
     if(updated_channels && new_videos) {
         if(host && host->notify_channels_multiple_videos) {
             host->notify_channels_multiple_videos(updated_channels, new_videos);
@@ -439,43 +682,163 @@ void action_refresh_all_channels(bool ask=true) {
     }
 }
 
+// Applies the results of finished refreshes. Returns whether there were any.
+bool apply_refresh_results()
+{
+    std::deque<refresh_result> results;
+    {
+        std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+        results.swap(refresh_worker.results);
+    }
+    if(results.empty())
+        return false;
+    for(const refresh_result &result: results) {
+        if(!result.database_error.empty())
+            tui_abort("%s", result.database_error.c_str());
+    }
+
+    const Channel &selected = channels.at(selected_channel);
+    bool selected_changed = false;
+    std::vector<std::string> failed_channels;
+    std::string first_error;
+    for(const refresh_result &result: results) {
+        int updated_channels = 0;
+        int new_videos = 0;
+        for(size_t i = 0; i < result.counts.size(); i++) {
+            const Channel &channel = result.job.channels[i];
+            if(!result.errors[i].empty()) {
+                failed_channels.push_back(channel.name);
+                if(first_error.empty())
+                    first_error = result.errors[i];
+            }
+            const int count = result.counts[i];
+            if(!count)
+                continue;
+            updated_channels++;
+            new_videos += count;
+
+            if(selected.is_virtual || selected.slot == channel.slot)
+                selected_changed = true;
+            if(result.job.notification == refresh_notification::PerChannel)
+                notify_new_videos(channel, count, result.titles[i]);
+        }
+        if(result.job.notification == refresh_notification::Summary)
+            notify_new_videos(updated_channels, new_videos);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(refresh_worker.mutex);
+        if(failed_channels.empty())
+            refresh_worker.errors.clear();
+        else if(failed_channels.size() == 1)
+            refresh_worker.errors = "Refreshing " + failed_channels.front() + " failed: " + first_error;
+        else
+            refresh_worker.errors = "Refreshing " + std::to_string(failed_channels.size()) + " channels failed: " + first_error;
+    }
+
+    // The videos are counted as they are stored, some may have been skipped as duplicates or
+    // already been changed by a mark-all that was queued meanwhile.
+    for(const auto &[group, count]: video_flag_index.update(db)) {
+        const auto &[slot, flags] = group;
+        video_counts.add(slot, flags, count);
+    }
+
+    if(refresh_schedule) {
+        const int64_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        for(const refresh_result &result: results) {
+            for(const Channel &channel: result.job.channels)
+                refresh_schedule->refreshed(db, channel, now);
+        }
+    }
+
+    // New videos show up above the selected one, which stays selected.
+    if(selected_changed) {
+        std::optional<std::pair<int64_t, int64_t>> key;
+        if(selected_video < channel_videos.size()) {
+            const Video &video = channel_videos.at(selected_video);
+            key = {video.timestamp, video.rowid};
+        }
+        channel_videos.reload();
+        selected_video = key ? channel_videos.position(key->first, key->second) : 0;
+        if(selected_video >= channel_videos.size())
+            selected_video = channel_videos.size() ? channel_videos.size() - 1 : 0;
+    }
+    return true;
+}
+
+void action_refresh_channel() {
+    const Channel &ch = channels.at(selected_channel);
+    if(ch.is_virtual)
+        reload_channel_videos();
+    else
+        queue_refresh({ch}, refresh_notification::PerChannel);
+}
+
+void action_refresh_all_channels() {
+    if(message_box("Refresh all channels?", "Do you want to refresh all " + std::to_string(channels.size()) + " channels?", Button::Yes | Button::No, Button::No) != Button::Yes)
+        return;
+    std::vector<Channel> to_refresh;
+    for(const Channel &channel: channels) {
+        if(!channel.is_virtual)
+            to_refresh.push_back(channel);
+    }
+    queue_refresh(std::move(to_refresh), refresh_notification::Summary);
+}
+
+void set_video_watched(Video &video, bool watched=true)
+{
+    const int old_flags = video.flags;
+    // Videos a running refresh already stored are counted with their flags once its results are
+    // applied.
+    if(video.set_flag(db, kWatched, watched) && video.rowid <= video_flag_index.last_rowid()) {
+        video_counts.change_flags(video.channel_slot, old_flags, video.flags);
+        video_flag_index.set_flags(video.timestamp, video.rowid, video.flags);
+    }
+}
+
+Video *get_selected_video()
+{
+    if(selected_video >= channel_videos.size())
+        return nullptr;
+    return &channel_videos.at(selected_video);
+}
+
 void action_mark_video_watched() {
-    Channel &ch = channels.at(selected_channel);
-    Video &video = videos[ch.id][selected_video];
-    video.set_flag(db, kWatched);
-    ch.load_info(db);
+    if(Video *video = get_selected_video())
+        set_video_watched(*video);
 }
 
 std::vector<std::string> watch_command = {"xdg-open", "https://youtube.com/watch?v={{vid}}"};
 
 void action_watch_video() {
-    Channel &ch = channels.at(selected_channel);
-    Video &video = videos[ch.id][selected_video];
+    Video *video = get_selected_video();
+    if(!video)
+        return;
 
-    if(run_command(watch_command, {{"{{vid}}", video.id}})) {
-        video.set_flag(db, kWatched);
-        ch.load_info(db);
+    if(run_command(watch_command, {{"{{vid}}", video->id.str()}})) {
+        set_video_watched(*video);
     }
 }
 
 void action_mark_video_unwatched() {
-    Channel &ch = channels.at(selected_channel);
-    Video &selected = videos[ch.id][selected_video];
-    selected.set_flag(db, kWatched, false);
-    ch.load_info(db);
+    if(Video *video = get_selected_video())
+        set_video_watched(*video, false);
 }
 
 void action_mark_all_videos_watched() {
     Channel &ch = channels.at(selected_channel);
+    if(ch.search) {
+        message_box("Can't mark all as watched", "Search results can only be marked one by one.");
+        return;
+    }
     if(message_box("Mark all as watched", "Do you want to mark all videos of " + ch.name + " as watched?", Button::Yes | Button::No, Button::No) != Button::Yes)
         return;
-    {
-        db_transaction transaction;
-        for(Video &video: videos[ch.id]) {
-            video.set_flag(db, kWatched);
-        }
+    for(const auto &[group, count]: ch.set_videos_flag(db, kWatched, true, video_flag_index.last_rowid())) {
+        const auto &[slot, flags] = group;
+        video_counts.change_flags(slot, flags, flags | kWatched, count);
     }
-    ch.load_info(db);
+    video_flag_index.set_videos_flag(ch, kWatched);
+    reload_channel_videos();
 }
 
 void action_select_prev_channel() {
@@ -494,7 +857,7 @@ void action_select_prev_video() {
 }
 
 void action_select_next_video() {
-    if(selected_video < current_video_count - 1)
+    if(selected_video + 1 < channel_videos.size())
         selected_video++;
 }
 
@@ -504,8 +867,8 @@ void action_select_prev_video_page() {
 }
 
 void action_select_next_video_page() {
-    if(selected_video < current_video_count - 1)
-        selected_video += std::min(current_video_count - 1 - selected_video, videos_per_page);
+    if(selected_video + 1 < channel_videos.size())
+        selected_video += std::min(channel_videos.size() - 1 - selected_video, videos_per_page);
 }
 
 void action_select_first_video() {
@@ -513,7 +876,8 @@ void action_select_first_video() {
 }
 
 void action_select_last_video() {
-    selected_video = current_video_count - 1;
+    if(channel_videos.size() > 0)
+        selected_video = channel_videos.size() - 1;
 }
 
 void action_scroll_title_left() {
@@ -529,17 +893,31 @@ void action_scroll_title_right() {
 void action_show_video_detail() {
     const size_t cols = termpaint_surface_width(surface);
 
-    const Channel &ch = channels.at(selected_channel);
-    const Video &selected = videos[ch.id][selected_video];
+    const Video *video = get_selected_video();
+    if(!video)
+        return;
+    const Video &selected = *video;
+    const VideoDetails &details = selected.get_details(db);
     std::string text;
     text.append("Video:\t").append(selected.title).append("\n");
-    text.append("Published:\t").append(selected.published).append("\n");
-    text.append("Added to playlist:\t").append(selected.added_to_playlist).append("\n");
-    text.append("\n").append(selected.description);
+    text.append("Published:\t").append(details.published).append("\n");
+    text.append("Added to playlist:\t").append(details.added_to_playlist).append("\n");
+    text.append("\n").append(details.description);
 
     message_box("Video Information", text_wrap(text, cols / 8 * 7));
 }
 
+void action_show_frame_statistics() {
+    const uint64_t frames = std::max<uint64_t>(1, frame_stats.frames);
+    std::string text;
+    text.append("Frames:\t").append(std::to_string(frame_stats.frames)).append("\n");
+    text.append("Full redraws:\t").append(std::to_string(frame_stats.full_redraws)).append("\n");
+    text.append("Rows drawn:\t").append(std::to_string(frame_stats.rows_drawn)).append("\n");
+    text.append("Average event to flush:\t").append(std::to_string(frame_stats.total_latency.count() / frames)).append(" µs\n");
+    text.append("Maximum event to flush:\t").append(std::to_string(frame_stats.max_latency.count())).append(" µs");
+    message_box("Frame time statistics", text);
+}
+
 void action_add_new_user_flag() {
     std::string name = get_string("Flag name");
     if(name.empty())
@@ -643,6 +1021,7 @@ void action_manage_user_flags() {
 
                 current_channel.user_flags ^= (1 << index);
                 current_channel.save_user_flags(db);
+                video_flag_index.set_user_flags(current_channel.slot, current_channel.user_flags);
             }
         }
     } while (!done);
@@ -868,15 +1247,55 @@ static void run()
         config_get_string_list(notify_channels_new_videos_command, notifications, "channelsNewVideosCommand");
     }
 
+    if(config.contains("databaseOptions") && config["databaseOptions"].is_object()) {
+        const json &options = config["databaseOptions"];
+        const auto get_choice = [&](std::string &out, const char *key, const std::set<std::string> &choices) {
+            if(options.contains(key) && options[key].is_string()) {
+                std::string value = options[key];
+                std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+                if(!choices.count(value))
+                    tui_abort(std::string("Invalid value for databaseOptions.") + key + ": " + value);
+                out = value;
+            }
+        };
+        get_choice(db_config.synchronous, "synchronous", {"OFF", "NORMAL", "FULL", "EXTRA"});
+        get_choice(db_config.temp_store, "tempStore", {"DEFAULT", "FILE", "MEMORY"});
+        if(options.contains("cacheSize") && options["cacheSize"].is_number_integer())
+            db_config.cache_size = options["cacheSize"];
+        if(options.contains("mmapSize") && options["mmapSize"].is_number_integer())
+            db_config.mmap_size = std::max<int64_t>(0, options["mmapSize"]);
+    }
+    if(config.count("refreshConcurrency") && config["refreshConcurrency"].is_number_integer()) {
+        yt_config.refresh_concurrency = std::max(1, config["refreshConcurrency"].get<int>());
+    }
+
     int auto_refresh_interval = -1; // In seconds
     if(config.count("autoRefreshInterval") && config["autoRefreshInterval"].is_number_integer()) {
         auto_refresh_interval = config["autoRefreshInterval"];
         auto_refresh_interval = std::max(-1, auto_refresh_interval);
     }
-    std::chrono::system_clock::time_point next_update = std::chrono::system_clock::now() + std::chrono::seconds(auto_refresh_interval);
+    int auto_refresh_max_interval = 7 * 24 * 60 * 60; // In seconds
+    if(config.count("autoRefreshMaxInterval") && config["autoRefreshMaxInterval"].is_number_integer()) {
+        auto_refresh_max_interval = config["autoRefreshMaxInterval"];
+    }
     std::chrono::system_clock::time_point last_user_action;
+    const auto next_timeout = [&]() -> int {
+        // A running refresh wakes the loop up when it is done.
+        if(!refresh_schedule || refresh_running())
+            return 0;
+        const std::optional<int64_t> next_due = refresh_schedule->next_due();
+        if(!next_due)
+            return 0;
+        // Auto refresh waits until the user has been inactive for a while.
+        const auto due = std::max(std::chrono::system_clock::from_time_t(*next_due), last_user_action + std::chrono::seconds(30));
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::system_clock::now());
+        return std::clamp<int64_t>(left.count(), 1, std::numeric_limits<int>::max());
+    };
 
+    yt_init();
     db_init(database_filename);
+    known_videos_open(db, database_filename + ".known");
+    start_refresh_worker();
 
     userFlags = UserFlag::get_all(db);
     add_virtual_channels();
@@ -888,6 +1307,15 @@ static void run()
         Channel ch = Channel::add_virtual(filter.name, filter);
         add_channel_to_list(ch);
     }
+    video_counts.load(db);
+    video_flag_index.load(db, channels);
+    channel_videos.flag_index = &video_flag_index;
+    channel_videos.prepare = prepare_video_for_display;
+    channel_videos.counter = [](const Channel &channel) { return video_counts.count(channel, channels); };
+    if(auto_refresh_interval != -1) {
+        refresh_schedule.emplace(auto_refresh_interval, auto_refresh_max_interval);
+        refresh_schedule->load(db, channels);
+    }
 
     if(!channels.empty()) {
         select_channel_by_index(0);
@@ -899,6 +1327,7 @@ static void run()
         {TERMPAINT_EV_CHAR, "a", 0, action_add_channel_by_name, "Add channel by name"},
         {TERMPAINT_EV_CHAR, "A", 0, action_add_channel_by_id, "Add channel by Id"},
         {TERMPAINT_EV_CHAR, "c", 0, action_select_channel, "Select channel"},
+        {TERMPAINT_EV_CHAR, "/", 0, action_search, "Search videos"},
         {TERMPAINT_EV_CHAR, "j", 0, action_select_prev_channel, "Select previous channel"},
         {TERMPAINT_EV_CHAR, "k", 0, action_select_next_channel, "Select next channel"},
         {TERMPAINT_EV_CHAR, "r", 0, action_refresh_channel, "Refresh selected channel"},
@@ -922,45 +1351,73 @@ static void run()
         {TERMPAINT_EV_CHAR, "l", TERMPAINT_MOD_CTRL, [&](){ force_repaint = true; }, "Force redraw"},
         {TERMPAINT_EV_KEY, "F2", 0, action_manage_user_flags, "Manage user flags"},
         {TERMPAINT_EV_KEY, "F3", 0, action_manage_channel_fitlers, "Manage channel filters"},
+        {TERMPAINT_EV_KEY, "F12", 0, action_show_frame_statistics, "Show frame time statistics"},
     };
 
     bool draw = true;
+    std::optional<std::chrono::steady_clock::time_point> event_received;
     do {
         if(host && host->quit && host->quit()) {
             break;
         }
 
+        if(apply_refresh_results())
+            draw = true;
+
         if(draw) {
             Channel &channel = channels.at(selected_channel);
-            termpaint_surface_clear(surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
-            draw_channel_list(videos[channel.id], channel.is_virtual);
+            if(force_repaint)
+                invalidate_channel_list();
+            draw_channel_list(channel_videos, channel.is_virtual);
             tp_flush(force_repaint);
             force_repaint = false;
+
+            if(event_received) {
+                const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - *event_received);
+                frame_stats.frames++;
+                frame_stats.total_latency += latency;
+                frame_stats.max_latency = std::max(frame_stats.max_latency, latency);
+            }
         }
         draw = true;
 
-        auto event = tp_wait_for_event(500);
+        auto event = tp_wait_for_event(next_timeout());
         if(!event)
             abort();
+        event_received = std::chrono::steady_clock::now();
 
         if(event->type == EV_TIMEOUT) {
-            draw = false;
-            const bool update_pending = next_update < std::chrono::system_clock::now();
+            // Wakeups from the refresh worker update the status line.
+            draw = refresh_running();
             const bool inactivity_threshold = (std::chrono::system_clock::now() - last_user_action) > std::chrono::seconds(30);
-            if(auto_refresh_interval != -1 && update_pending && inactivity_threshold) {
-                action_refresh_all_channels(false);
-                next_update = std::chrono::system_clock::now() + std::chrono::seconds(auto_refresh_interval);
-                draw = true;
+            if(refresh_schedule && inactivity_threshold && !refresh_running()) {
+                std::vector<Channel> due;
+                for(const int slot: refresh_schedule->take_due(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))) {
+                    if(const Channel *channel = channel_by_slot(slot))
+                        due.push_back(*channel);
+                }
+                if(!due.empty()) {
+                    queue_refresh(std::move(due), refresh_notification::Summary);
+                    draw = true;
+                }
             }
         } else if(tui_handle_action(*event, actions)) {
             last_user_action = std::chrono::system_clock::now();
         }
     } while (!exit);
 
+    stop_refresh_worker();
+    known_videos_save(db);
     db_shutdown();
+    yt_shutdown();
     curl_global_cleanup();
 }
 
+void application_wakeup()
+{
+    tp_wakeup();
+}
+
 void run_standalone()
 {
     tp_init();
@@ -10,5 +10,8 @@ struct application_host {
     std::function<void(const int channels, const int count)> notify_channels_multiple_videos = nullptr;
 };
 
+// Makes the main loop check for things like host->quit. Can be called from any thread.
+void application_wakeup();
+
 void run_standalone();
 void run_embedded(int pty_fd, application_host *host);
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: MIT
+// Refreshes channels against a local stand-in for the YouTube API and counts the connections the
+// requests needed. Takes the number of channels, 100 by default.
+#include "../db.h"
+#include "../yt.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+void tui_abort(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every channel has this many pages of 50 videos, the same ones on every refresh.
+static constexpr int pages_per_channel = 3;
+
+static std::atomic<int> connections{0};
+static std::atomic<int> requests{0};
+
+static std::string query_param(const std::string &target, const std::string &name)
+{
+    const size_t start = target.find(name + "=");
+    if(start == std::string::npos)
+        return "";
+    const size_t value = start + name.size() + 1;
+    return target.substr(value, target.find('&', value) - value);
+}
+
+static std::string playlist_page(const std::string &playlist_id, int page)
+{
+    const int channel = atoi(playlist_id.c_str() + 2);
+    std::string body = R"({"kind": "youtube#playlistItemListResponse", )";
+    if(page + 1 < pages_per_channel)
+        body += R"("nextPageToken": ")" + std::to_string(page + 1) + R"(", )";
+    body += R"("items": [)";
+    for(int i = 0; i < 50; i++) {
+        char video_id[16];
+        snprintf(video_id, sizeof video_id, "b%05d%02d%02d", channel, page, i);
+        if(i)
+            body += ", ";
+        body += R"({"kind": "youtube#playlistItem", "snippet": {"publishedAt": "2021-03-14T16:00:11Z", "channelId": "UC)"
+                + playlist_id.substr(2) + R"(", "title": "Video )" + video_id + R"(", "description": "A description of the video.",)"
+                + R"( "thumbnails": {"default": {"url": "https://i.ytimg.com/vi/x/default.jpg", "width": 120, "height": 90}},)"
+                + R"( "resourceId": {"kind": "youtube#video", "videoId": ")" + video_id + R"("}},)"
+                + R"( "contentDetails": {"videoId": ")" + video_id + R"(", "videoPublishedAt": "2021-03-14T16:00:11Z"}})";
+    }
+    body += R"(], "pageInfo": {"totalResults": 150, "resultsPerPage": 50}})";
+    return body;
+}
+
+// Answers HTTP/1.1 requests on one connection until the client closes it.
+static void serve(int fd)
+{
+    std::string buffer;
+    char chunk[4096];
+    for(;;) {
+        size_t end;
+        while((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            const ssize_t got = read(fd, chunk, sizeof chunk);
+            if(got <= 0) {
+                close(fd);
+                return;
+            }
+            buffer.append(chunk, got);
+        }
+        const std::string target = buffer.substr(buffer.find(' ') + 1, buffer.find(' ', buffer.find(' ') + 1) - buffer.find(' ') - 1);
+        buffer.erase(0, end + 4);
+        requests++;
+
+        const std::string page = query_param(target, "pageToken");
+        const std::string body = playlist_page(query_param(target, "playlistId"), page.empty() ? 0 : atoi(page.c_str()));
+        const std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n" + body;
+        for(size_t sent = 0; sent < response.size();) {
+            const ssize_t written = write(fd, response.data() + sent, response.size() - sent);
+            if(written <= 0) {
+                close(fd);
+                return;
+            }
+            sent += written;
+        }
+    }
+}
+
+static int start_server()
+{
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof address;
+    if(bind(listener, (sockaddr *)&address, length) != 0 || listen(listener, 64) != 0
+            || getsockname(listener, (sockaddr *)&address, &length) != 0)
+        tui_abort("Failed to start the server");
+
+    std::thread([listener] {
+        for(;;) {
+            const int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0)
+                continue;
+            connections++;
+            std::thread(serve, fd).detach();
+        }
+    }).detach();
+    return ntohs(address.sin_port);
+}
+
+static void refresh(const std::vector<Channel> &channels, const char *name)
+{
+    std::vector<const Channel*> list;
+    for(const Channel &channel: channels)
+        list.push_back(&channel);
+
+    const int connections_before = connections;
+    const int requests_before = requests;
+    const auto start = std::chrono::steady_clock::now();
+    int videos = 0;
+    std::thread([&] {
+        // Like the application, refreshes run on a reader connection of their own.
+        sqlite3 *reader = db_open_reader();
+        std::vector<std::string> errors;
+        for(const int count: Channel::fetch_new_videos_parallel(reader, list, errors))
+            videos += count;
+        for(const std::string &error: errors) {
+            if(!error.empty())
+                tui_abort("Refresh failed: %s", error.c_str());
+        }
+        db_close_reader(reader);
+    }).join();
+    printf("%-14s %5d requests %4d connections %6d videos %9.2f ms\n", name, requests - requests_before,
+           connections - connections_before, videos, elapsed_ms(start));
+}
+
+int main(int argc, char *argv[])
+{
+    const int channel_count = argc > 1 ? atoi(argv[1]) : 100;
+    const std::string filename = "api_requests_benchmark.db";
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+
+    yt_config.api_key = "benchmark";
+    yt_config.api_url = "http://127.0.0.1:" + std::to_string(start_server()) + "/youtube/v3/";
+    yt_init();
+    db_init(filename);
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(sqlite3_prepare_v2(db, "INSERT INTO channels(channelId, name) VALUES(?1, ?1);", -1, &query, nullptr));
+        for(int i = 0; i < channel_count; i++) {
+            char id[32];
+            snprintf(id, sizeof id, "UC%022d", i);
+            SC(sqlite3_bind_text(query, 1, id, -1, SQLITE_TRANSIENT));
+            sqlite3_step(query);
+            SC(sqlite3_reset(query));
+        }
+        SC(sqlite3_finalize(query));
+    });
+    const std::vector<Channel> channels = Channel::get_all(db);
+
+    // The first refresh loads every page, later ones stop at the first known video.
+    refresh(channels, "first refresh");
+    refresh(channels, "next refresh");
+    refresh(channels, "next refresh");
+
+    db_shutdown();
+    yt_shutdown();
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+    return 0;
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: MIT
+// Lists a virtual channel of a large database once with its SQL queries and once from the flag
+// index, and checks that both show the same videos. Takes the number of videos, 1000000 by default.
+#include "../db.h"
+#include "../yt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+void tui_abort(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void fill(int videos, int channels)
+{
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(sqlite3_prepare_v2(db, "INSERT INTO channels(channelId, name, user_flags) VALUES(?1, ?2, ?3);", -1, &query, nullptr));
+        for(int i = 0; i < channels; i++) {
+            char id[32];
+            snprintf(id, sizeof id, "UC%022d", i);
+            SC(sqlite3_bind_text(query, 1, id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_text(query, 2, id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_int(query, 3, i % 4));
+            sqlite3_step(query);
+            SC(sqlite3_reset(query));
+        }
+        SC(sqlite3_finalize(query));
+
+        SC(sqlite3_prepare_v2(db, "INSERT INTO videos(videoId, channelId, title, flags, sort_key) VALUES(?1, ?2, 'title', ?3, ?4);", -1, &query, nullptr));
+        srand(1);
+        for(int i = 0; i < videos; i++) {
+            char id[16], channel_id[32];
+            snprintf(id, sizeof id, "v%010d", i);
+            snprintf(channel_id, sizeof channel_id, "UC%022d", rand() % channels);
+            SC(sqlite3_bind_text(query, 1, id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_text(query, 2, channel_id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_int(query, 3, rand() % 4));
+            SC(sqlite3_bind_int64(query, 4, rand() % 100000000));
+            sqlite3_step(query);
+            SC(sqlite3_reset(query));
+        }
+        SC(sqlite3_finalize(query));
+    });
+}
+
+// Times reset and a few windows spread over the list, like scrolling through it.
+static std::vector<std::string> list_videos(VideoList &list, const Channel &channel, const char *name)
+{
+    auto start = std::chrono::steady_clock::now();
+    list.reset(channel);
+    printf("%-6s count:  %9.2f ms for %zu videos\n", name, elapsed_ms(start), list.size());
+
+    std::vector<std::string> ids;
+    start = std::chrono::steady_clock::now();
+    for(size_t first: {size_t(0), list.size() / 4, list.size() / 2, list.size() - std::min(list.size(), size_t(40))}) {
+        list.load(first, 40);
+        for(size_t i = first; i < std::min(list.size(), first + 40); i++)
+            ids.push_back(list.at(i).id.str());
+    }
+    printf("%-6s window: %9.2f ms for 4 windows\n", name, elapsed_ms(start) / 4);
+    return ids;
+}
+
+int main(int argc, char *argv[])
+{
+    const int videos = argc > 1 ? atoi(argv[1]) : 1000000;
+    const std::string filename = "flag_index_benchmark.db";
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+
+    db_init(filename);
+    auto start = std::chrono::steady_clock::now();
+    fill(videos, 200);
+    printf("filling: %.0f ms\n", elapsed_ms(start));
+
+    const std::vector<Channel> channels = Channel::get_all(db);
+    ChannelFilter filter;
+    filter.video_mask = kWatched;
+    filter.video_value = 0;
+    filter.user_mask = 1;
+    filter.user_value = 1;
+    const Channel channel = Channel::add_virtual("unwatched", filter);
+
+    VideoList sql_list;
+    const std::vector<std::string> sql_ids = list_videos(sql_list, channel, "sql");
+
+    start = std::chrono::steady_clock::now();
+    VideoFlagIndex index;
+    index.load(db, channels);
+    printf("index  load:   %9.2f ms\n", elapsed_ms(start));
+
+    VideoList index_list;
+    index_list.flag_index = &index;
+    const std::vector<std::string> index_ids = list_videos(index_list, channel, "index");
+
+    db_shutdown();
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+
+    if(sql_list.size() != index_list.size() || sql_ids != index_ids) {
+        fprintf(stderr, "The lists differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+// Counts the heap allocations of loading video list windows. Takes the number of videos, 100000 by
+// default.
+#include "../db.h"
+#include "../yt.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if(void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void tui_abort(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void fill(int videos, int channels)
+{
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(sqlite3_prepare_v2(db, "INSERT INTO channels(channelId, name) VALUES(?1, ?1);", -1, &query, nullptr));
+        for(int i = 0; i < channels; i++) {
+            char id[32];
+            snprintf(id, sizeof id, "UC%022d", i);
+            SC(sqlite3_bind_text(query, 1, id, -1, SQLITE_TRANSIENT));
+            sqlite3_step(query);
+            SC(sqlite3_reset(query));
+        }
+        SC(sqlite3_finalize(query));
+
+        SC(sqlite3_prepare_v2(db, "INSERT INTO videos(videoId, channelId, title, flags, sort_key) VALUES(?1, ?2, ?3, 0, ?4);", -1, &query, nullptr));
+        srand(1);
+        for(int i = 0; i < videos; i++) {
+            char id[16], channel_id[32], title[64];
+            snprintf(id, sizeof id, "v%010d", i);
+            snprintf(channel_id, sizeof channel_id, "UC%022d", rand() % channels);
+            // Long enough to not fit into the small string buffer.
+            snprintf(title, sizeof title, "Video number %d of the benchmark channel", i);
+            SC(sqlite3_bind_text(query, 1, id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_text(query, 2, channel_id, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_text(query, 3, title, -1, SQLITE_TRANSIENT));
+            SC(sqlite3_bind_int64(query, 4, rand() % 100000000));
+            sqlite3_step(query);
+            SC(sqlite3_reset(query));
+        }
+        SC(sqlite3_finalize(query));
+    });
+}
+
+static void measure(const char *name, VideoList &list, size_t first, size_t rows)
+{
+    const size_t before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    list.load(first, rows);
+    const double ms = elapsed_ms(start);
+    printf("%-28s %8zu allocations %9.2f ms\n", name, allocations - before, ms);
+}
+
+int main(int argc, char *argv[])
+{
+    const int videos = argc > 1 ? atoi(argv[1]) : 100000;
+    const std::string filename = "video_list_benchmark.db";
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+
+    db_init(filename);
+    // A single channel, so its list has every video.
+    fill(videos, 1);
+
+    VideoList list;
+    list.reset(Channel::get_all(db).front());
+
+    // A window of 100 rows on screen is loaded with 100 rows of margin on both sides.
+    measure("window of 300 rows", list, list.size() / 2, 100);
+    measure("scrolling past the margin", list, list.size() / 2 + 200, 100);
+    list.reload();
+    measure("full list", list, 0, list.size());
+
+    db_shutdown();
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+    return 0;
+}
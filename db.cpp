@@ -1,16 +1,228 @@
 // SPDX-License-Identifier: MIT
 #include "db.h"
 
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 sqlite3 *db = nullptr;
+struct db_config db_config;
+static std::string db_filename;
+// The thread that called db_init, the only one that may show errors.
+static std::thread::id main_thread;
+
+void db_fail(const char *fmt, ...)
+{
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    const int required = vsnprintf(nullptr, 0, fmt, ap);
+    va_end(ap);
+    std::string message(required > 0 ? required : 0, 0);
+    vsnprintf(message.data(), message.size() + 1, fmt, ap2);
+    va_end(ap2);
+
+    if(std::this_thread::get_id() == main_thread)
+        tui_abort("%s", message.c_str());
+    throw db_error(message);
+}
+
+struct cached_statement {
+    sqlite3_stmt *query;
+    bool in_use;
+};
 
-db_transaction::db_transaction()
+// Keyed by the statement's own copy of its SQL text, so lookups don't need to allocate.
+static std::unordered_map<sqlite3*, std::unordered_map<std::string_view, cached_statement>> statement_cache;
+static db_statement_cache_stats statement_cache_stats = {0, 0};
+static std::mutex statement_cache_mutex;
+
+int db_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **query)
 {
-    sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    // Reads on the main connection always see the writes the thread queued before.
+    if(db == ::db)
+        db_sync();
+
+    std::lock_guard<std::mutex> lock(statement_cache_mutex);
+    auto &statements = statement_cache[db];
+    const auto it = statements.find(sql);
+    if(it != statements.end() && !it->second.in_use) {
+        statement_cache_stats.hits++;
+        it->second.in_use = true;
+        *query = it->second.query;
+        return SQLITE_OK;
+    }
+
+    statement_cache_stats.misses++;
+    const int res = sqlite3_prepare_v2(db, sql, -1, query, nullptr);
+    // A statement that is still in use (e.g. by an outer loop) is not replaced, the new one
+    // gets finalized by db_release instead.
+    if(res == SQLITE_OK && *query && it == statements.end())
+        statements.emplace(sqlite3_sql(*query), cached_statement{*query, true});
+    return res;
 }
 
-db_transaction::~db_transaction()
+int db_release(sqlite3_stmt *query)
 {
-    sqlite3_exec(db, "COMMIT TRANSACTION;", nullptr, nullptr, nullptr);
+    std::lock_guard<std::mutex> lock(statement_cache_mutex);
+    auto &statements = statement_cache[sqlite3_db_handle(query)];
+    const auto it = statements.find(sqlite3_sql(query));
+    if(it == statements.end() || it->second.query != query)
+        return sqlite3_finalize(query);
+
+    it->second.in_use = false;
+    const int res = sqlite3_reset(query);
+    sqlite3_clear_bindings(query);
+    return res;
+}
+
+static void db_finalize_statements(sqlite3 *db)
+{
+    std::lock_guard<std::mutex> lock(statement_cache_mutex);
+    for(auto &[sql, statement]: statement_cache[db])
+        sqlite3_finalize(statement.query);
+    statement_cache.erase(db);
+}
+
+db_statement_cache_stats db_get_statement_cache_stats()
+{
+    std::lock_guard<std::mutex> lock(statement_cache_mutex);
+    return statement_cache_stats;
+}
+
+// All writes are executed by the writer thread on its own connection. Commands that are queued
+// while the thread is busy are committed together in one transaction.
+static sqlite3 *write_db = nullptr;
+static std::thread writer;
+static std::mutex writer_mutex;
+static std::condition_variable writer_wakeup;
+static std::condition_variable writer_done;
+struct writer_command {
+    db_command command;
+    // Failures are reported to the thread that queued the command.
+    std::thread::id thread;
+};
+static std::deque<writer_command> writer_queue;
+static uint64_t writer_submitted = 0;
+static uint64_t writer_completed = 0;
+static bool writer_stop = false;
+// The first failed write of each thread, reported and cleared by its next writer_wait.
+static std::unordered_map<std::thread::id, std::string> writer_errors;
+
+// Runs the command in its own savepoint, so a failure only undoes its own changes and not those
+// of the other commands in the transaction. Returns the error, if any.
+static std::string writer_run(const db_command &command)
+{
+    try {
+        SC(sqlite3_exec(write_db, "SAVEPOINT command;", nullptr, nullptr, nullptr));
+        try {
+            command(write_db);
+        } catch(...) {
+            sqlite3_exec(write_db, "ROLLBACK TO command; RELEASE command;", nullptr, nullptr, nullptr);
+            throw;
+        }
+        SC(sqlite3_exec(write_db, "RELEASE command;", nullptr, nullptr, nullptr));
+    } catch(const std::exception &err) {
+        return err.what();
+    }
+    return std::string();
+}
+
+static void writer_main()
+{
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while(true) {
+        writer_wakeup.wait(lock, []{ return writer_stop || !writer_queue.empty(); });
+        if(writer_queue.empty())
+            break;
+
+        std::deque<writer_command> commands;
+        commands.swap(writer_queue);
+        lock.unlock();
+
+        std::vector<std::string> errors(commands.size());
+        std::string transaction_error;
+        try {
+            SC(sqlite3_exec(write_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr));
+            for(size_t i = 0; i < commands.size(); i++)
+                errors[i] = writer_run(commands[i].command);
+            SC(sqlite3_exec(write_db, "COMMIT TRANSACTION;", nullptr, nullptr, nullptr));
+        } catch(const db_error &err) {
+            sqlite3_exec(write_db, "ROLLBACK TRANSACTION;", nullptr, nullptr, nullptr);
+            transaction_error = err.what();
+        }
+
+        lock.lock();
+        for(size_t i = 0; i < commands.size(); i++) {
+            const std::string &error = transaction_error.empty() ? errors[i] : transaction_error;
+            if(!error.empty())
+                writer_errors.emplace(commands[i].thread, error);
+        }
+        writer_completed += commands.size();
+        writer_done.notify_all();
+    }
+}
+
+// Sequence number of the last command submitted by this thread. Commands are executed in order,
+// so waiting for it is enough to see all own writes, without waiting for those of other threads.
+static thread_local uint64_t thread_submitted = 0;
+
+static uint64_t writer_submit(db_command &&command)
+{
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    writer_queue.push_back({std::move(command), std::this_thread::get_id()});
+    writer_wakeup.notify_one();
+    thread_submitted = ++writer_submitted;
+    return thread_submitted;
+}
+
+static void writer_wait(const uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    writer_done.wait(lock, [sequence]{ return writer_completed >= sequence; });
+    const auto it = writer_errors.find(std::this_thread::get_id());
+    if(it != writer_errors.end()) {
+        const std::string error = std::move(it->second);
+        writer_errors.erase(it);
+        lock.unlock();
+        db_fail("%s", error.c_str());
+    }
+}
+
+void db_write(db_command command)
+{
+    writer_submit(std::move(command));
+}
+
+void db_write_sync(db_command command)
+{
+    db_sync();
+    writer_wait(writer_submit(std::move(command)));
+}
+
+void db_sync()
+{
+    writer_wait(thread_submitted);
+}
+
+// Commits what is queued and ends the writer thread.
+static void writer_shutdown()
+{
+    if(!writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_stop = true;
+        writer_wakeup.notify_one();
+    }
+    writer.join();
 }
 
 std::string get_string(sqlite3_stmt *row, int col)
@@ -21,39 +233,102 @@ std::string get_string(sqlite3_stmt *row, int col)
     return std::string();
 }
 
+std::string_view get_string_view(sqlite3_stmt *row, int col)
+{
+    const unsigned char *cp = sqlite3_column_text(row, col);
+    if(cp)
+        return std::string_view((const char*)cp, sqlite3_column_bytes(row, col));
+    return std::string_view();
+}
+
 int get_int(sqlite3_stmt *row, int col)
 {
     return sqlite3_column_int(row, col);
 }
 
-void db_check_schema();
+static void db_check_schema(sqlite3 *db);
+
+static void db_configure_connection(sqlite3 *db)
+{
+    const std::string pragmas = "PRAGMA synchronous = " + db_config.synchronous + ";"
+            "PRAGMA cache_size = " + std::to_string(db_config.cache_size) + ";"
+            "PRAGMA mmap_size = " + std::to_string(db_config.mmap_size) + ";"
+            "PRAGMA temp_store = " + db_config.temp_store + ";";
+    SC(sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, nullptr));
+    SC(sqlite3_busy_timeout(db, 5000));
+}
 
 void db_init(const std::string &filename)
 {
-    SC(sqlite3_open(filename.c_str(), &db));
-    db_check_schema();
+    main_thread = std::this_thread::get_id();
+    SC(sqlite3_open(filename.c_str(), &write_db));
+    SC(sqlite3_exec(write_db, "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr));
+    db_configure_connection(write_db);
+    db_check_schema(write_db);
+
+    // The main connection is only used for reading, all writes go through the writer thread.
+    db_filename = filename;
+    db = db_open_reader();
+
+    writer_stop = false;
+    writer = std::thread(writer_main);
+    // tui_abort exits without db_shutdown. The thread has to end before the objects it waits on
+    // are destroyed.
+    std::atexit(writer_shutdown);
+}
+
+sqlite3 *db_open_reader()
+{
+    sqlite3 *reader;
+    SC(sqlite3_open(db_filename.c_str(), &reader));
+    db_configure_connection(reader);
+    SC(sqlite3_exec(reader, "PRAGMA query_only = 1;", nullptr, nullptr, nullptr));
+    return reader;
+}
+
+void db_close_reader(sqlite3 *reader)
+{
+    db_finalize_statements(reader);
+    sqlite3_close(reader);
 }
 
 void db_shutdown()
 {
-    sqlite3_close(db);
+    writer_shutdown();
+
+    db_close_reader(db);
     db = nullptr;
+
+    db_finalize_statements(write_db);
+    sqlite3_close(write_db);
+    write_db = nullptr;
+}
+
+static std::string get_setting(sqlite3 *db, const std::string &key)
+{
+    sqlite3_stmt *query;
+    SC(db_prepare(db, "SELECT value FROM settings WHERE key = ?1;", &query));
+    SC(sqlite3_bind_text(query, 1, key.c_str(), -1, SQLITE_TRANSIENT));
+    SC(sqlite3_step(query));
+    std::string value = get_string(query, 0);
+    SC(db_release(query));
+    return value;
 }
 
-void db_check_schema() {
+static void db_check_schema(sqlite3 *db) {
     bool settings_table_found = false;
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master WHERE type='table';", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT name FROM sqlite_master WHERE type='table';", &query));
     while(sqlite3_step(query) == SQLITE_ROW) {
         if(get_string(query, 0) == "settings")
             settings_table_found = true;
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
 
     int schema_version = 0;
     if(settings_table_found) {
-        const std::string schema_version_str = db_get_setting("schema_version");
+        const std::string schema_version_str = get_setting(db, "schema_version");
         if(!schema_version_str.empty()) {
             schema_version = std::stoi(schema_version_str);
         }
@@ -61,7 +336,6 @@ void db_check_schema() {
     if(schema_version < 1) {
         const std::string db_init_sql = R"(
 PRAGMA foreign_keys;
-PRAGMA synchronous = NORMAL;
 CREATE TABLE channels (
     channelId TEXT PRIMARY KEY,
     name TEXT
@@ -105,6 +379,59 @@ CREATE TABLE channel_filters (
     user_value INTEGER DEFAULT 0
 );
 UPDATE settings SET value="3" WHERE key="schema_version";
+)";
+        SC(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+    if(schema_version < 4) {
+        const std::string sql = R"(
+ALTER TABLE videos ADD COLUMN sort_key INTEGER NOT NULL DEFAULT 0;
+UPDATE videos SET sort_key = coalesce(CAST(strftime('%s', coalesce(nullif(published, ''), added_to_playlist)) AS INTEGER), 0);
+CREATE INDEX videos_channel_sort_key ON videos(channelId, sort_key DESC);
+CREATE INDEX videos_channel_flags ON videos(channelId, flags);
+UPDATE settings SET value="4" WHERE key="schema_version";
+)";
+        SC(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+    if(schema_version < 5) {
+        const std::string sql = R"(
+ALTER TABLE channels ADD COLUMN next_refresh INTEGER DEFAULT 0;
+UPDATE settings SET value="5" WHERE key="schema_version";
+)";
+        SC(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+    if(schema_version < 6) {
+        const std::string sql = R"(
+CREATE VIRTUAL TABLE videos_fts USING fts5(title, description, content='videos', content_rowid='rowid', prefix='2 3');
+INSERT INTO videos_fts(videos_fts) VALUES('rebuild');
+CREATE TRIGGER videos_fts_insert AFTER INSERT ON videos BEGIN
+    INSERT INTO videos_fts(rowid, title, description) VALUES(new.rowid, new.title, new.description);
+END;
+CREATE TRIGGER videos_fts_delete AFTER DELETE ON videos BEGIN
+    INSERT INTO videos_fts(videos_fts, rowid, title, description) VALUES('delete', old.rowid, old.title, old.description);
+END;
+CREATE TRIGGER videos_fts_update AFTER UPDATE OF title, description ON videos BEGIN
+    INSERT INTO videos_fts(videos_fts, rowid, title, description) VALUES('delete', old.rowid, old.title, old.description);
+    INSERT INTO videos_fts(rowid, title, description) VALUES(new.rowid, new.title, new.description);
+END;
+UPDATE settings SET value="6" WHERE key="schema_version";
+)";
+        SC(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+    if(schema_version < 7) {
+        // Bumped in the same transaction as any change to the set of videos, so files derived from
+        // it can tell whether they are still current.
+        const std::string sql = R"(
+INSERT INTO settings(key, value) VALUES("videos_generation", abs(random() % 1000000000000));
+CREATE TRIGGER videos_generation_insert AFTER INSERT ON videos BEGIN
+    UPDATE settings SET value = value + 1 WHERE key = 'videos_generation';
+END;
+CREATE TRIGGER videos_generation_delete AFTER DELETE ON videos BEGIN
+    UPDATE settings SET value = value + 1 WHERE key = 'videos_generation';
+END;
+CREATE TRIGGER videos_generation_update AFTER UPDATE OF videoId, channelId ON videos BEGIN
+    UPDATE settings SET value = value + 1 WHERE key = 'videos_generation';
+END;
+UPDATE settings SET value="7" WHERE key="schema_version";
 )";
         SC(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
     }
@@ -112,23 +439,19 @@ UPDATE settings SET value="3" WHERE key="schema_version";
 
 std::string db_get_setting(const std::string &key)
 {
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT value FROM settings WHERE key = ?1;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, key.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_step(query));
-    std::string value = get_string(query, 0);
-    SC(sqlite3_finalize(query));
-    return value;
+    return get_setting(db, key);
 }
 
 void db_set_setting(const std::string &key, const std::string &value)
 {
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "INSERT INTO settings(key, value) values(?1, ?2) ON CONFLICT(key) DO UPDATE SET value=excluded.value;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, key.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 2, value.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    db_write([=](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "INSERT INTO settings(key, value) values(?1, ?2) ON CONFLICT(key) DO UPDATE SET value=excluded.value;", &query));
+        SC(sqlite3_bind_text(query, 1, key.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_text(query, 2, value.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
 }
 
 std::map<std::string, std::string> db_get_settings(const std::string &prefix)
@@ -136,7 +459,7 @@ std::map<std::string, std::string> db_get_settings(const std::string &prefix)
     std::map<std::string, std::string> result;
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT key, value FROM settings WHERE key LIKE ?1;", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT key, value FROM settings WHERE key LIKE ?1;", &query));
     SC(sqlite3_bind_text(query, 1, (prefix + ":").c_str(), -1, SQLITE_TRANSIENT));
     while(sqlite3_step(query) == SQLITE_ROW) {
         const std::string key = get_string(query, 0);
@@ -146,6 +469,6 @@ std::map<std::string, std::string> db_get_settings(const std::string &prefix)
             result.emplace(key.substr(i), value);
         }
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
     return result;
 }
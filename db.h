@@ -1,25 +1,70 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <sqlite3.h>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
+// Connection for reading. Writes are passed to db_write and executed on the writer thread.
 extern sqlite3 *db;
 
+extern struct db_config {
+    std::string synchronous = "NORMAL";
+    int cache_size = -16000;
+    int64_t mmap_size = 256 * 1024 * 1024;
+    std::string temp_store = "MEMORY";
+} db_config;
+
 extern void tui_abort(const char *fmt, ...);
-#define SC(x) { const int res = (x); if(res != SQLITE_OK && res != SQLITE_ROW && res != SQLITE_DONE) { tui_abort("Database error:\n%s failed: (%d) %s", #x, res, sqlite3_errstr(res)); }}
+#define SC(x) { const int res = (x); if(res != SQLITE_OK && res != SQLITE_ROW && res != SQLITE_DONE) { db_fail("Database error:\n%s failed: (%d) %s", #x, res, sqlite3_errstr(res)); }}
 
-class db_transaction {
+// Only the main thread may show errors. On other threads SC throws a db_error instead, which they
+// hand over to the main thread.
+class db_error: public std::runtime_error
+{
 public:
-    db_transaction();
-    ~db_transaction();
+    using std::runtime_error::runtime_error;
 };
+// Calls tui_abort on the main thread, throws a db_error on others.
+void db_fail(const char *fmt, ...);
+
+using db_command = std::function<void(sqlite3 *db)>;
+
+// Queues a write for the writer thread. The command gets the writer's connection. If it throws,
+// only its own changes are rolled back and the error is reported to the thread that queued it.
+void db_write(db_command command);
+// Like db_write, but waits until the command is committed.
+void db_write_sync(db_command command);
+// Waits until all writes queued so far by the calling thread are committed. Fails like SC if one
+// of them failed on the writer thread since the last check.
+void db_sync();
+
+// Prepared statements are cached per connection and SQL text. Use db_prepare instead of
+// sqlite3_prepare_v2 and hand the statement back with db_release instead of sqlite3_finalize.
+// Preparing a statement on the main connection calls db_sync first.
+int db_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **query);
+int db_release(sqlite3_stmt *query);
+
+struct db_statement_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+};
+db_statement_cache_stats db_get_statement_cache_stats();
+
 std::string get_string(sqlite3_stmt *row, int col);
+// Only valid until the row is stepped or reset.
+std::string_view get_string_view(sqlite3_stmt *row, int col);
 int get_int(sqlite3_stmt *row, int col);
 
 void db_init(const std::string &filename);
 void db_shutdown();
+// Opens another read-only connection, for reading on a thread other than the main one.
+sqlite3 *db_open_reader();
+void db_close_reader(sqlite3 *reader);
 
 std::string db_get_setting(const std::string &key);
 void db_set_setting(const std::string &key, const std::string &value);
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: MIT
+#include "json_stream.h"
+
+#include <cctype>
+
+json_stream_parser::json_stream_parser(json_stream_handler &handler): handler(handler)
+{
+    reset();
+}
+
+void json_stream_parser::reset()
+{
+    current_status = Status::Ok;
+    state = State::Value;
+    containers.clear();
+    buffer.clear();
+    string_is_key = false;
+    unicode = 0;
+    unicode_digits = 0;
+    high_surrogate = 0;
+}
+
+static bool is_whitespace(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_literal_char(const char c)
+{
+    return std::isalnum((unsigned char)c) || c == '-' || c == '+' || c == '.';
+}
+
+static int hex_value(const char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+json_stream_parser::Status json_stream_parser::feed(const char *data, size_t size)
+{
+    const char *p = data;
+    const char *end = data + size;
+
+    while(current_status == Status::Ok && p < end) {
+        const char c = *p;
+
+        switch(state) {
+        case State::String: {
+            // Copy everything up to the next quote or escape sequence in one go.
+            const char *stop = p;
+            while(stop < end && *stop != '"' && *stop != '\\')
+                stop++;
+            buffer.append(p, stop);
+            p = stop;
+            if(p == end)
+                break;
+            p++;
+            if(*stop == '\\') {
+                state = State::StringEscape;
+            } else if(string_is_key) {
+                state = State::Colon;
+                if(!handler.key(buffer))
+                    current_status = Status::Stopped;
+            } else if(!handler.string(buffer)) {
+                current_status = Status::Stopped;
+            } else {
+                end_value();
+            }
+            break;
+        }
+        case State::StringEscape:
+            p++;
+            state = State::String;
+            switch(c) {
+            case '"': buffer.push_back('"'); break;
+            case '\\': buffer.push_back('\\'); break;
+            case '/': buffer.push_back('/'); break;
+            case 'b': buffer.push_back('\b'); break;
+            case 'f': buffer.push_back('\f'); break;
+            case 'n': buffer.push_back('\n'); break;
+            case 'r': buffer.push_back('\r'); break;
+            case 't': buffer.push_back('\t'); break;
+            case 'u':
+                state = State::StringUnicode;
+                unicode = 0;
+                unicode_digits = 0;
+                break;
+            default:
+                current_status = Status::Error;
+                break;
+            }
+            break;
+        case State::StringUnicode: {
+            const int digit = hex_value(c);
+            if(digit < 0) {
+                current_status = Status::Error;
+                break;
+            }
+            p++;
+            unicode = (unicode << 4) | digit;
+            if(++unicode_digits < 4)
+                break;
+
+            state = State::String;
+            if(high_surrogate) {
+                if(unicode >= 0xDC00 && unicode <= 0xDFFF) {
+                    append_codepoint(0x10000 + ((high_surrogate - 0xD800) << 10) + (unicode - 0xDC00));
+                } else {
+                    append_codepoint(0xFFFD);
+                    append_codepoint(unicode);
+                }
+                high_surrogate = 0;
+            } else if(unicode >= 0xD800 && unicode <= 0xDBFF) {
+                high_surrogate = unicode;
+                state = State::SurrogateBackslash;
+            } else {
+                append_codepoint(unicode);
+            }
+            break;
+        }
+        case State::SurrogateBackslash:
+            if(c == '\\') {
+                p++;
+                state = State::SurrogateU;
+            } else {
+                append_codepoint(0xFFFD);
+                high_surrogate = 0;
+                state = State::String;
+            }
+            break;
+        case State::SurrogateU:
+            if(c == 'u') {
+                p++;
+                state = State::StringUnicode;
+                unicode = 0;
+                unicode_digits = 0;
+            } else {
+                // The backslash already got consumed, so this is a regular escape sequence.
+                append_codepoint(0xFFFD);
+                high_surrogate = 0;
+                state = State::StringEscape;
+            }
+            break;
+        case State::Literal:
+            if(is_literal_char(c)) {
+                buffer.push_back(c);
+                p++;
+            } else {
+                end_literal();
+            }
+            break;
+        default:
+            if(is_whitespace(c)) {
+                p++;
+                break;
+            }
+
+            switch(state) {
+            case State::Value:
+                begin_value(c);
+                break;
+            case State::ValueOrArrayEnd:
+                if(c == ']')
+                    end_container(c);
+                else
+                    begin_value(c);
+                break;
+            case State::KeyOrObjectEnd:
+            case State::Key:
+                if(c == '"') {
+                    state = State::String;
+                    string_is_key = true;
+                    buffer.clear();
+                } else if(c == '}' && state == State::KeyOrObjectEnd) {
+                    end_container(c);
+                } else {
+                    current_status = Status::Error;
+                }
+                break;
+            case State::Colon:
+                if(c == ':')
+                    state = State::Value;
+                else
+                    current_status = Status::Error;
+                break;
+            case State::CommaOrEnd:
+                if(c == ',')
+                    state = containers.back() == '{' ? State::Key : State::Value;
+                else
+                    end_container(c);
+                break;
+            default:
+                current_status = Status::Error;
+                break;
+            }
+            if(state != State::Literal)
+                p++;
+            break;
+        }
+    }
+
+    return current_status;
+}
+
+json_stream_parser::Status json_stream_parser::finish()
+{
+    if(current_status == Status::Ok && state == State::Literal)
+        end_literal();
+    if(current_status == Status::Ok && state != State::Done)
+        current_status = Status::Error;
+    return current_status;
+}
+
+bool json_stream_parser::begin_value(const char c)
+{
+    bool ok = true;
+    if(c == '"') {
+        state = State::String;
+        string_is_key = false;
+        buffer.clear();
+    } else if(c == '{') {
+        containers.push_back('{');
+        state = State::KeyOrObjectEnd;
+        ok = handler.begin_object();
+    } else if(c == '[') {
+        containers.push_back('[');
+        state = State::ValueOrArrayEnd;
+        ok = handler.begin_array();
+    } else if(c == '-' || std::isalnum((unsigned char)c)) {
+        // The first character is not consumed but collected by the Literal state.
+        state = State::Literal;
+        buffer.clear();
+    } else {
+        current_status = Status::Error;
+        return false;
+    }
+
+    if(!ok)
+        current_status = Status::Stopped;
+    return ok;
+}
+
+bool json_stream_parser::end_value()
+{
+    state = containers.empty() ? State::Done : State::CommaOrEnd;
+    return true;
+}
+
+bool json_stream_parser::end_container(const char c)
+{
+    const char expected = c == '}' ? '{' : '[';
+    if(containers.empty() || containers.back() != expected || (c != '}' && c != ']')) {
+        current_status = Status::Error;
+        return false;
+    }
+    containers.pop_back();
+
+    const bool ok = c == '}' ? handler.end_object() : handler.end_array();
+    if(!ok) {
+        current_status = Status::Stopped;
+        return false;
+    }
+    return end_value();
+}
+
+bool json_stream_parser::end_literal()
+{
+    const bool valid = buffer == "true" || buffer == "false" || buffer == "null"
+            || buffer[0] == '-' || std::isdigit((unsigned char)buffer[0]);
+    if(!valid) {
+        current_status = Status::Error;
+        return false;
+    }
+    if(!handler.literal(buffer)) {
+        current_status = Status::Stopped;
+        return false;
+    }
+    return end_value();
+}
+
+void json_stream_parser::append_codepoint(unsigned int cp)
+{
+    if(cp >= 0xD800 && cp <= 0xDFFF)
+        cp = 0xFFFD;
+
+    if(cp < 0x80) {
+        buffer.push_back(cp);
+    } else if(cp < 0x800) {
+        buffer.push_back(0xC0 | (cp >> 6));
+        buffer.push_back(0x80 | (cp & 0x3F));
+    } else if(cp < 0x10000) {
+        buffer.push_back(0xE0 | (cp >> 12));
+        buffer.push_back(0x80 | ((cp >> 6) & 0x3F));
+        buffer.push_back(0x80 | (cp & 0x3F));
+    } else {
+        buffer.push_back(0xF0 | (cp >> 18));
+        buffer.push_back(0x80 | ((cp >> 12) & 0x3F));
+        buffer.push_back(0x80 | ((cp >> 6) & 0x3F));
+        buffer.push_back(0x80 | (cp & 0x3F));
+    }
+}
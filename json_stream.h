@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Receives the events of a json_stream_parser. Returning false from any callback stops parsing.
+class json_stream_handler
+{
+public:
+    virtual ~json_stream_handler() = default;
+
+    virtual bool begin_object() { return true; }
+    virtual bool end_object() { return true; }
+    virtual bool begin_array() { return true; }
+    virtual bool end_array() { return true; }
+    virtual bool key(const std::string &) { return true; }
+    virtual bool string(const std::string &) { return true; }
+    // Numbers, true, false and null are passed on as their unparsed text.
+    virtual bool literal(const std::string &) { return true; }
+};
+
+// Push parser for JSON documents that arrive in arbitrary chunks, e.g. from a curl write callback.
+class json_stream_parser
+{
+public:
+    enum class Status {
+        Ok,
+        Stopped,
+        Error,
+    };
+
+    json_stream_parser(json_stream_handler &handler);
+
+    Status feed(const char *data, size_t size);
+    Status finish();
+    Status status() const { return current_status; }
+    void reset();
+
+private:
+    enum class State {
+        Value,
+        ValueOrArrayEnd,
+        KeyOrObjectEnd,
+        Key,
+        Colon,
+        CommaOrEnd,
+        String,
+        StringEscape,
+        StringUnicode,
+        SurrogateBackslash,
+        SurrogateU,
+        Literal,
+        Done,
+    };
+
+    bool begin_value(const char c);
+    bool end_value();
+    bool end_container(const char c);
+    bool end_literal();
+    void append_codepoint(unsigned int cp);
+
+    json_stream_handler &handler;
+    Status current_status;
+    State state;
+    std::vector<char> containers;
+    std::string buffer;
+    bool string_is_key;
+    unsigned int unicode;
+    unsigned int unicode_digits;
+    unsigned int high_surrogate;
+};
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+#include "queries.h"
+
+// The columns Video is constructed from, in order.
+#define VIDEO_COLUMNS "SELECT videoId, videos.channelId, title, videos.flags, sort_key, videos.rowid "
+
+std::string video_scope_sql(VideoScope scope)
+{
+    switch(scope) {
+    case VideoScope::VideoAndUserFlags:
+        return "FROM videos JOIN channels ON videos.channelId = channels.channelId"
+               " WHERE videos.flags & ?1 = ?2 AND channels.user_flags & ?3 = ?4";
+    case VideoScope::VideoFlags:
+        return "FROM videos WHERE videos.flags & ?1 = ?2";
+    case VideoScope::Channel:
+        break;
+    }
+    return "FROM videos WHERE videos.channelId = ?1";
+}
+
+std::string video_count_sql(VideoScope scope)
+{
+    return "SELECT count(*) " + video_scope_sql(scope) + ";";
+}
+
+std::string video_position_sql(VideoScope scope)
+{
+    return "SELECT sort_key, videos.rowid " + video_scope_sql(scope) + " ORDER BY sort_key DESC, videos.rowid LIMIT 1 OFFSET ?5;";
+}
+
+std::string video_window_sql(VideoScope scope)
+{
+    return VIDEO_COLUMNS + video_scope_sql(scope)
+            + " AND sort_key <= ?5 AND (sort_key < ?5 OR videos.rowid >= ?6) ORDER BY sort_key DESC, videos.rowid LIMIT ?7;";
+}
+
+std::string video_rank_sql(VideoScope scope)
+{
+    return "SELECT count(*) " + video_scope_sql(scope) + " AND (sort_key > ?5 OR (sort_key = ?5 AND videos.rowid < ?6));";
+}
+
+static std::string video_flag_changing_sql(bool value)
+{
+    return value ? "videos.flags & ?5 = 0" : "videos.flags & ?5 != 0";
+}
+
+std::string video_flag_count_sql(VideoScope scope, bool value)
+{
+    return "SELECT videos.channelId, videos.flags, count(*) " + video_scope_sql(scope) + " AND " + video_flag_changing_sql(value)
+            + " AND videos.rowid <= ?6 GROUP BY videos.channelId, videos.flags;";
+}
+
+std::string video_flag_update_sql(VideoScope scope, bool value)
+{
+    const std::string set = value ? "flags = flags | ?5" : "flags = flags & ~?5";
+    const std::string changing = video_flag_changing_sql(value);
+    switch(scope) {
+    case VideoScope::VideoAndUserFlags:
+        return "UPDATE videos SET " + set + " WHERE " + changing + " AND videos.flags & ?1 = ?2"
+               " AND channelId IN (SELECT channelId FROM channels WHERE user_flags & ?3 = ?4);";
+    case VideoScope::VideoFlags:
+        return "UPDATE videos SET " + set + " WHERE " + changing + " AND videos.flags & ?1 = ?2;";
+    case VideoScope::Channel:
+        break;
+    }
+    return "UPDATE videos SET " + set + " WHERE " + changing + " AND channelId = ?1;";
+}
+
+const char video_by_rowid_sql[] = VIDEO_COLUMNS "FROM videos WHERE videos.rowid = ?1;";
+const char video_details_sql[] = "SELECT description, added_to_playlist, published FROM videos WHERE videoId = ?1;";
+const char known_videos_sql[] = "SELECT videoId FROM videos WHERE channelId=?1;";
+const char newest_video_sql[] = "SELECT title FROM videos WHERE channelId = ?1 ORDER BY sort_key DESC LIMIT 1;";
+const char upload_gaps_sql[] = "SELECT max(sort_key), min(sort_key), count(*) FROM (SELECT sort_key FROM videos WHERE channelId = ?1 AND sort_key > 0 ORDER BY sort_key DESC LIMIT ?2);";
+// Sorting in memory is a lot faster than letting SQLite order by (sort_key, rowid).
+const char flag_index_sql[] = "SELECT channelId, flags, sort_key, rowid FROM videos WHERE rowid > ?1;";
+
+const char search_count_sql[] = "SELECT count(*) FROM videos_fts WHERE videos_fts MATCH ?1;";
+const char search_ranked_sql[] = "SELECT rowid FROM videos_fts WHERE videos_fts MATCH ?1 ORDER BY bm25(videos_fts, 10.0, 1.0), rowid DESC;";
+const char search_recent_sql[] = "SELECT rowid FROM videos_fts WHERE videos_fts MATCH ?1 ORDER BY rowid DESC LIMIT ?2 OFFSET ?3;";
+const char search_recent_rank_sql[] = "SELECT count(*) FROM videos_fts WHERE videos_fts MATCH ?1 AND rowid > ?2;";
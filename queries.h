@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <string>
+
+// The SQL of the queries that run often. tests/query_plans.cpp checks that exactly these keep
+// using their indexes.
+
+// Which videos a list shows: the videos of one channel, or those matching the filter of a virtual
+// channel, on video flags only or on the user flags of their channel as well.
+enum class VideoScope {
+    Channel,
+    VideoFlags,
+    VideoAndUserFlags,
+};
+
+// FROM and WHERE clause of the scope. It uses the parameters ?1 to ?4: the channel id, or the
+// video mask and value followed by the user mask and value.
+std::string video_scope_sql(VideoScope scope);
+// Videos are listed by sort key, newest first, and by rowid within the same sort key.
+std::string video_count_sql(VideoScope scope);
+// The sort key and rowid of the video at offset ?5.
+std::string video_position_sql(VideoScope scope);
+// At most ?7 videos, starting at sort key ?5 and rowid ?6.
+std::string video_window_sql(VideoScope scope);
+// The number of videos before sort key ?5 and rowid ?6.
+std::string video_rank_sql(VideoScope scope);
+// The number of videos per channel and flags that setting (or clearing) flag ?5 changes, counting
+// only videos up to rowid ?6.
+std::string video_flag_count_sql(VideoScope scope, bool value);
+std::string video_flag_update_sql(VideoScope scope, bool value);
+
+// Selects the same columns as video_window_sql.
+extern const char video_by_rowid_sql[];
+extern const char video_details_sql[];
+extern const char known_videos_sql[];
+extern const char newest_video_sql[];
+extern const char upload_gaps_sql[];
+extern const char flag_index_sql[];
+
+// Searches take the FTS5 query as ?1. Titles weigh ten times as much as descriptions.
+extern const char search_count_sql[];
+extern const char search_ranked_sql[];
+// ?2 matches from offset ?3, most recently stored first.
+extern const char search_recent_sql[];
+// The number of matches before rowid ?2 in that order.
+extern const char search_recent_rank_sql[];
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: MIT
+// Feeds a playlistItems response to json_stream_parser split at every byte offset and compares the
+// result with nlohmann::json::parse.
+#include "../json_stream.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Trimmed from a real response. The titles and descriptions carry escapes and a surrogate pair,
+// the thumbnails and tags are nested containers the extraction has to skip.
+static const char playlist_items[] = R"json({
+  "kind": "youtube#playlistItemListResponse",
+  "etag": "k5yLxkxNM1lpIIYWFYKx0PSnlZM",
+  "nextPageToken": "EAAaBlBUOkNBSQ",
+  "items": [
+    {
+      "kind": "youtube#playlistItem",
+      "etag": "Ty5lCGtkQQB2CtjC5S-TpeoG_EM",
+      "id": "VVVYdU1UQ0tsTkRIQ0xJZDA2T1RHeGdRLjJYNE1vR1FVN3ZZ",
+      "snippet": {
+        "publishedAt": "2021-03-14T16:00:11Z",
+        "channelId": "UCXuMTCKlNDHCLId06OTGxgQ",
+        "title": "Say \"hello\" to C:\\Users \u00e9t\u00e9 \ud83c\udfb5",
+        "description": "Line one\nLine two\twith tab\r\nhttps:\/\/example.com\/watch?v=1&t=2\u0000end",
+        "thumbnails": {
+          "default": {"url": "https://i.ytimg.com/vi/2X4MoGQU7vY/default.jpg", "width": 120, "height": 90},
+          "high": {"url": "https://i.ytimg.com/vi/2X4MoGQU7vY/hqdefault.jpg", "width": 480, "height": 360}
+        },
+        "tags": ["music", ["nested", {"deep": [1, 2.5e-3, -7]}], []],
+        "channelTitle": "Some Channel",
+        "playlistId": "UUXuMTCKlNDHCLId06OTGxgQ",
+        "position": 0,
+        "resourceId": {"kind": "youtube#video", "videoId": "2X4MoGQU7vY"},
+        "videoOwnerChannelTitle": "Some Channel",
+        "videoOwnerChannelId": "UCXuMTCKlNDHCLId06OTGxgQ"
+      },
+      "contentDetails": {"videoId": "2X4MoGQU7vY", "videoPublishedAt": "2021-03-14T16:00:11Z"}
+    },
+    {
+      "kind": "youtube#playlistItem",
+      "etag": "3bm0Ln1kbZ8A6D6Ct1-F7PjGsHg",
+      "id": "VVVYdU1UQ0tsTkRIQ0xJZDA2T1RHeGdRLmJwYlJwS0RRNnJN",
+      "snippet": {
+        "publishedAt": "2021-03-07T16:00:03Z",
+        "channelId": "UCXuMTCKlNDHCLId06OTGxgQ",
+        "title": "",
+        "description": "{\"not\": [\"json\"]}",
+        "thumbnails": {},
+        "channelTitle": "Some Channel",
+        "playlistId": "UUXuMTCKlNDHCLId06OTGxgQ",
+        "position": 1,
+        "resourceId": {"kind": "youtube#video", "videoId": "bpbRpKDQ6rM"},
+        "private": false,
+        "unlisted": null
+      },
+      "contentDetails": {"videoId": "bpbRpKDQ6rM", "videoPublishedAt": "2021-03-07T16:00:03Z"}
+    },
+    {
+      "kind": "youtube#playlistItem",
+      "etag": "Ckx4UdZ2oCTMXN7cqEvtIhgZVsQ",
+      "id": "VVVYdU1UQ0tsTkRIQ0xJZDA2T1RHeGdRLk5sTlJCUFhGeWNr",
+      "snippet": {
+        "publishedAt": "2021-02-28T16:00:00Z",
+        "channelId": "UCXuMTCKlNDHCLId06OTGxgQ",
+        "title": "Third",
+        "description": "",
+        "resourceId": {"kind": "youtube#video", "videoId": "NlNRBPXFyck"}
+      },
+      "contentDetails": {"videoId": "NlNRBPXFyck", "videoPublishedAt": "2021-02-28T16:00:00Z"}
+    }
+  ],
+  "pageInfo": {"totalResults": 3, "resultsPerPage": 50}
+}
+)json";
+
+// Rebuilds the document from the parser events.
+class json_builder: public json_stream_handler
+{
+public:
+    json result;
+
+    void reset()
+    {
+        result = json();
+        stack.clear();
+        keys.clear();
+    }
+
+    bool begin_object() override
+    {
+        return push(json::object());
+    }
+    bool end_object() override
+    {
+        return pop();
+    }
+    bool begin_array() override
+    {
+        return push(json::array());
+    }
+    bool end_array() override
+    {
+        return pop();
+    }
+    bool key(const std::string &k) override
+    {
+        keys.back() = k;
+        return true;
+    }
+    bool string(const std::string &value) override
+    {
+        return add(value);
+    }
+    bool literal(const std::string &value) override
+    {
+        // Truncated numbers like "2." get through, the document is rejected once it ends.
+        return add(json::parse(value, nullptr, false));
+    }
+
+private:
+    bool push(json value)
+    {
+        stack.push_back(std::move(value));
+        keys.emplace_back();
+        return true;
+    }
+    bool pop()
+    {
+        json value = std::move(stack.back());
+        stack.pop_back();
+        keys.pop_back();
+        return add(std::move(value));
+    }
+    bool add(json value)
+    {
+        if(stack.empty())
+            result = std::move(value);
+        else if(stack.back().is_object())
+            stack.back()[keys.back()] = std::move(value);
+        else
+            stack.back().push_back(std::move(value));
+        return true;
+    }
+
+    std::vector<json> stack;
+    std::vector<std::string> keys;
+};
+
+// Collects items[].snippet.resourceId.videoId the way the playlist page handler does, and stops at
+// a known video.
+class video_id_collector: public json_stream_handler
+{
+public:
+    std::string stop_at;
+    std::vector<std::string> video_ids;
+
+    void reset()
+    {
+        path.clear();
+        current_key.clear();
+        video_ids.clear();
+    }
+
+    bool begin_object() override
+    {
+        path.push_back(current_key);
+        return true;
+    }
+    bool end_object() override
+    {
+        path.pop_back();
+        return true;
+    }
+    bool begin_array() override
+    {
+        path.push_back(current_key);
+        current_key.clear();
+        return true;
+    }
+    bool end_array() override
+    {
+        path.pop_back();
+        return true;
+    }
+    bool key(const std::string &k) override
+    {
+        current_key = k;
+        return true;
+    }
+    bool string(const std::string &value) override
+    {
+        if(path.size() != 5 || path[1] != "items" || path[3] != "snippet" || path[4] != "resourceId" || current_key != "videoId")
+            return true;
+        if(value == stop_at)
+            return false;
+        video_ids.push_back(value);
+        return true;
+    }
+
+private:
+    std::vector<std::string> path;
+    std::string current_key;
+};
+
+static int failed = 0;
+
+static void check(bool ok, const char *what, size_t split)
+{
+    if(ok)
+        return;
+    failed++;
+    fprintf(stderr, "%s fails when split at %zu\n", what, split);
+}
+
+// Feeds data in two chunks, the first one ending at split.
+static json_stream_parser::Status parse_split(json_stream_parser &parser, const std::string &data, size_t split)
+{
+    parser.reset();
+    parser.feed(data.data(), split);
+    parser.feed(data.data() + split, data.size() - split);
+    return parser.finish();
+}
+
+int main()
+{
+    const std::string document = playlist_items;
+    const json expected = json::parse(document);
+    const std::vector<std::string> all_ids = {"2X4MoGQU7vY", "bpbRpKDQ6rM", "NlNRBPXFyck"};
+
+    json_builder builder;
+    json_stream_parser build_parser(builder);
+    video_id_collector collector;
+    json_stream_parser collect_parser(collector);
+
+    for(size_t split = 0; split <= document.size(); split++) {
+        builder.reset();
+        check(parse_split(build_parser, document, split) == json_stream_parser::Status::Ok, "parsing", split);
+        check(builder.result == expected, "rebuilding the document", split);
+
+        collector.reset();
+        collector.stop_at.clear();
+        check(parse_split(collect_parser, document, split) == json_stream_parser::Status::Ok, "collecting", split);
+        check(collector.video_ids == all_ids, "collecting video ids", split);
+
+        collector.reset();
+        collector.stop_at = all_ids[1];
+        check(parse_split(collect_parser, document, split) == json_stream_parser::Status::Stopped, "stopping", split);
+        check(collector.video_ids == std::vector<std::string>(all_ids.begin(), all_ids.begin() + 1), "stopping at a known video", split);
+    }
+
+    // Everything before the closing brace is incomplete.
+    const size_t complete = document.rfind('}') + 1;
+    for(size_t length = 0; length < complete; length++) {
+        builder.reset();
+        build_parser.reset();
+        build_parser.feed(document.data(), length);
+        check(build_parser.finish() == json_stream_parser::Status::Error, "truncated document", length);
+    }
+
+    for(const char *broken: {R"({"a": "\x"})", R"({"a" 1})", R"([1, 2)", R"({"a": 1}})"}) {
+        builder.reset();
+        build_parser.reset();
+        build_parser.feed(broken, std::string(broken).size());
+        if(build_parser.finish() != json_stream_parser::Status::Error) {
+            failed++;
+            fprintf(stderr, "%s is accepted\n", broken);
+        }
+    }
+
+    // Lone surrogates are replaced instead of failing the whole page.
+    builder.reset();
+    const std::string lone_surrogate = R"({"a": "x\ud83cy", "b": "\udfb5"})";
+    parse_split(build_parser, lone_surrogate, 0);
+    check(builder.result == json{{"a", "x\xef\xbf\xbdy"}, {"b", "\xef\xbf\xbd"}}, "replacing lone surrogates", 0);
+
+    if(failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed ? 1 : 0;
+}
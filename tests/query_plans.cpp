@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+// Checks that the hot queries keep using their indexes. The SQL comes from queries.cpp, the same
+// strings the application runs.
+#include "../db.h"
+#include "../queries.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+void tui_abort(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+struct plan_check {
+    const char *name;
+    std::string sql;
+    // Must appear in one of the plan lines.
+    const char *uses;
+};
+
+// Lists of virtual channels come from the flag index, only the queries of channel lists are
+// checked.
+static const plan_check checks[] = {
+    {"channel window", video_window_sql(VideoScope::Channel), "USING INDEX videos_channel_sort_key"},
+    {"channel position", video_position_sql(VideoScope::Channel), "USING COVERING INDEX videos_channel_sort_key"},
+    {"channel rank", video_rank_sql(VideoScope::Channel), "videos_channel_sort_key"},
+    {"mark all counts", video_flag_count_sql(VideoScope::Channel, true), "USING COVERING INDEX videos_channel_flags"},
+    {"video by rowid", video_by_rowid_sql, "USING INTEGER PRIMARY KEY"},
+    {"video details", video_details_sql, "USING INDEX sqlite_autoindex_videos_1"},
+    {"known videos", known_videos_sql, "(channelId=?)"},
+    {"newest video", newest_video_sql, "USING INDEX videos_channel_sort_key"},
+    {"upload gaps", upload_gaps_sql, "USING COVERING INDEX videos_channel_sort_key"},
+    {"flag index", flag_index_sql, "USING INTEGER PRIMARY KEY"},
+    // Ranked searches sort by score, they are limited to small results instead.
+    {"search count", search_count_sql, "VIRTUAL TABLE INDEX"},
+    {"recent search results", search_recent_sql, "VIRTUAL TABLE INDEX"},
+    {"recent search rank", search_recent_rank_sql, "VIRTUAL TABLE INDEX"},
+};
+
+static std::vector<std::string> query_plan(const std::string &sql)
+{
+    std::vector<std::string> plan;
+    sqlite3_stmt *query;
+    SC(sqlite3_prepare_v2(db, ("EXPLAIN QUERY PLAN " + sql).c_str(), -1, &query, nullptr));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        plan.push_back(get_string(query, 3));
+    SC(sqlite3_finalize(query));
+    return plan;
+}
+
+int main()
+{
+    const std::string filename = "query_plans_test.db";
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+
+    db_init(filename);
+    int failed = 0;
+    for(const plan_check &check: checks) {
+        const std::vector<std::string> plan = query_plan(check.sql);
+        bool uses = false;
+        bool slow = false;
+        for(const std::string &line: plan) {
+            uses |= line.find(check.uses) != std::string::npos;
+            // Sorting runs of equal sort keys is fine, sorting all rows or scanning the table isn't.
+            slow |= line == "USE TEMP B-TREE FOR ORDER BY" || line == "SCAN videos";
+        }
+        if(uses && !slow)
+            continue;
+
+        failed++;
+        fprintf(stderr, "%s: expected a plan using '%s' without a full scan or sort, got:\n", check.name, check.uses);
+        for(const std::string &line: plan)
+            fprintf(stderr, "    %s\n", line.c_str());
+    }
+    db_shutdown();
+
+    for(const char *suffix: {"", "-wal", "-shm"})
+        std::remove((filename + suffix).c_str());
+    return failed ? 1 : 0;
+}
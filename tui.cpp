@@ -2,15 +2,27 @@
 #include "tui.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <deque>
+#include <numeric>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 termpaint_integration *integration;
 termpaint_terminal *terminal;
 termpaint_surface *surface;
+unsigned int overlay_generation = 0;
 
 AttributeSet attributes[ASetTypeCount];
 std::unordered_map<std::string, std::string> key_symbols;
@@ -25,6 +37,25 @@ std::vector<button_info> all_buttons;
 
 std::deque<Event> eventqueue;
 
+// The terminal is only polled through this, reading it is left to termpaint.
+static int input_fd = -1;
+// After reading input termpaint may wait for the rest of an escape sequence, which it only
+// finishes inside its own iteration.
+static bool termpaint_settling = false;
+
+// Never closed, so tp_wakeup can be called from other threads at any time.
+static int wakeup_fd()
+{
+    static const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fd;
+}
+
+// Reused by everything that measures text. Widths of non-ASCII strings are cached, titles and
+// names get measured again whenever their list is reloaded.
+static termpaint_text_measurement *measurement = nullptr;
+static constexpr size_t width_cache_size = 8192;
+static std::unordered_map<size_t, std::pair<std::string, size_t>> width_cache;
+
 static void convert_tp_event(void *, termpaint_event *tp_event) {
     Event e;
     if (tp_event->type == TERMPAINT_EV_CHAR) {
@@ -40,27 +71,58 @@ static void convert_tp_event(void *, termpaint_event *tp_event) {
     }
 }
 
+static void push_event(int type)
+{
+    Event e;
+    e.modifier = 0;
+    e.type = type;
+    eventqueue.push_back(e);
+}
+
 std::optional<Event> wait_for_event(termpaint_integration *integration, int timeout) {
     const int cols = termpaint_surface_width(surface);
     const int rows = termpaint_surface_height(surface);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
     while (eventqueue.empty()) {
+        int remaining = -1;
+        if(timeout > 0) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            remaining = std::max<int>(0, left.count());
+        }
+        if(remaining == 0) {
+            push_event(EV_TIMEOUT);
+            break;
+        }
+
+        int iteration_timeout = 0;
+        if(termpaint_settling) {
+            iteration_timeout = termpaint_settling && (remaining < 0 || remaining > 100) ? 100 : remaining;
+            termpaint_settling = false;
+        } else {
+            pollfd fds[2] = {{input_fd, POLLIN, 0}, {wakeup_fd(), POLLIN, 0}};
+            const int ret = poll(fds, wakeup_fd() >= 0 ? 2 : 1, remaining);
+            if(ret < 0 && errno != EINTR)
+                return {};
+            if(ret > 0 && (fds[1].revents & POLLIN)) {
+                uint64_t count;
+                (void)!read(wakeup_fd(), &count, sizeof(count));
+                push_event(EV_TIMEOUT);
+            }
+            // Signals like SIGWINCH interrupt the poll, termpaint needs to see those as well.
+            if(ret == 0 || (ret > 0 && !fds[0].revents))
+                continue;
+            termpaint_settling = true;
+        }
+
         bool ok = false;
-        if(timeout > 0)
-            ok = termpaintx_full_integration_do_iteration_with_timeout(integration, &timeout);
-        else
+        if(iteration_timeout < 0)
             ok = termpaintx_full_integration_do_iteration(integration);
+        else
+            ok = termpaintx_full_integration_do_iteration_with_timeout(integration, &iteration_timeout);
         if (!ok) {
             return {}; // or some other error handling
         } else if(cols != termpaint_surface_width(surface) || rows != termpaint_surface_height(surface)) {
-            Event e;
-            e.modifier = 0;
-            e.type = EV_RESIZE;
-            eventqueue.push_back(e);
-        } else if(timeout == 0) {
-            Event e;
-            e.modifier = 0;
-            e.type = EV_TIMEOUT;
-            eventqueue.push_back(e);
+            push_event(EV_RESIZE);
         }
     }
     Event e = eventqueue.front();
@@ -104,6 +166,17 @@ static const char* terminal_options = "+kbdsig +kbdsigint +kbdsigtstp";
 void tp_init()
 {
     integration = termpaintx_full_integration_setup_terminal_fullscreen( "+kbdsig +kbdsigint +kbdsigtstp", convert_tp_event, nullptr, &terminal);
+    // termpaint uses the controlling terminal, which can be polled through any fd that refers to it.
+    input_fd = open("/dev/tty", O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if(input_fd < 0 && isatty(STDIN_FILENO))
+        input_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    if(input_fd < 0) {
+        // Reading without polling would block tp_wakeup and every timeout.
+        const int error = errno;
+        termpaint_terminal_free_with_restore(terminal);
+        fprintf(stderr, "Error: Could not open the terminal for input: %s\n", strerror(error));
+        exit(1);
+    }
     tp_init_internal();
 }
 
@@ -128,6 +201,7 @@ void tp_init_from_fd(int fd)
     termpaint_terminal_setup_fullscreen(terminal, width, height, terminal_options);
     termpaintx_full_integration_ttyrescue_start(integration);
 
+    input_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
     tp_init_internal();
 }
 
@@ -142,6 +216,18 @@ void tp_shutdown()
     free_attr_set(attributes[ASWatched]);
     free_attr_set(attributes[ASUnwatched]);
 
+    if(measurement) {
+        termpaint_text_measurement_free(measurement);
+        measurement = nullptr;
+    }
+    width_cache.clear();
+
+    if(input_fd >= 0) {
+        close(input_fd);
+        input_fd = -1;
+    }
+    termpaint_settling = false;
+
     termpaint_terminal_free_with_restore(terminal);
 }
 
@@ -155,6 +241,13 @@ std::optional<Event> tp_wait_for_event(int timeout)
     return wait_for_event(integration, timeout);
 }
 
+void tp_wakeup()
+{
+    const uint64_t one = 1;
+    if(wakeup_fd() >= 0)
+        (void)!write(wakeup_fd(), &one, sizeof(one));
+}
+
 static std::string repeated(const int n, const std::string &what)
 {
     std::string out;
@@ -163,12 +256,33 @@ static std::string repeated(const int n, const std::string &what)
     return out;
 }
 
-size_t string_width(const std::string &str)
+static termpaint_text_measurement *get_measurement()
+{
+    if(!measurement)
+        measurement = termpaint_text_measurement_new(surface);
+    termpaint_text_measurement_reset(measurement);
+    return measurement;
+}
+
+size_t string_width(std::string_view str)
 {
-    termpaint_text_measurement *m = termpaint_text_measurement_new(surface);
-    termpaint_text_measurement_feed_utf8(m, str.c_str(), str.length(), true);
-    const int width = termpaint_text_measurement_last_width(m);
-    termpaint_text_measurement_free(m);
+    // Printable ASCII is one column per byte.
+    if(std::all_of(str.begin(), str.end(), [](const char c) { return c >= 0x20 && c < 0x7f; }))
+        return str.size();
+
+    // Keyed by hash, so a lookup doesn't need to copy the string.
+    const size_t hash = std::hash<std::string_view>()(str);
+    const auto it = width_cache.find(hash);
+    if(it != width_cache.end() && it->second.first == str)
+        return it->second.second;
+
+    termpaint_text_measurement *m = get_measurement();
+    termpaint_text_measurement_feed_utf8(m, str.data(), str.size(), true);
+    const size_t width = termpaint_text_measurement_last_width(m);
+
+    if(width_cache.size() >= width_cache_size)
+        width_cache.clear();
+    width_cache[hash] = {std::string(str), width};
     return width;
 }
 
@@ -209,6 +323,7 @@ public:
 
 void draw_box_with_caption(int x, int y, int w, int h, const std::string &caption)
 {
+    overlay_generation++;
     termpaint_surface_clear_rect(surface, x, y, w, h, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
     const int fill = w - 2;
     const int endy = y+h;
@@ -237,15 +352,28 @@ int get_selection(const std::string &caption, const std::vector<std::string> &en
     for(const auto &e: entries)
         cols_needed = std::max(cols_needed, string_width(e));
 
-    cols_needed += 4; // Border and left/right padding
+    const int cols = termpaint_surface_width(surface);
+    const int rows = termpaint_surface_height(surface);
 
-    const int rows_needed = entries.size()+2; // Number of entries and top/bottom border
+    cols_needed = std::min<size_t>(cols_needed + 4, cols); // Border and left/right padding
+    const int rows_needed = std::min<int>(entries.size() + 2, rows); // Number of entries and top/bottom border
+    // Longer lists scroll, only the entries from first to first + visible_rows are drawn.
+    const size_t visible_rows = std::max(rows_needed - 2, 0);
+    size_t first = 0;
+
+    int x, y;
+    resolve_align(align, cols_needed, rows_needed, 0, cols, 0, rows, x, y);
+    surface_backup backup(x, y, cols_needed, rows_needed);
 
     bool done = false;
     bool force_repaint = false;
     std::vector<action> actions = {
         {TERMPAINT_EV_KEY, "ArrowUp", 0, [&](){ if(selected > 0) selected--; }, "Previous option"},
         {TERMPAINT_EV_KEY, "ArrowDown", 0, [&](){ if(selected < entries.size() - 1) selected++; }, "Next option"},
+        {TERMPAINT_EV_KEY, "PageUp", 0, [&](){ selected -= std::min(selected, visible_rows); }, "Previous page"},
+        {TERMPAINT_EV_KEY, "PageDown", 0, [&](){ if(!entries.empty()) selected = std::min(selected + visible_rows, entries.size() - 1); }, "Next page"},
+        {TERMPAINT_EV_KEY, "Home", 0, [&](){ selected = 0; }, "First option"},
+        {TERMPAINT_EV_KEY, "End", 0, [&](){ if(!entries.empty()) selected = entries.size() - 1; }, "Last option"},
         {TERMPAINT_EV_KEY, "Escape", 0, [&](){ selected = -1; done = true; }, "Abort selection"},
         {TERMPAINT_EV_KEY, "Enter", 0, [&](){ done = true; }, "Confirm selection"},
         {EV_IGNORE, "1..9", 0, nullptr, "Select option 1..9"},
@@ -253,21 +381,15 @@ int get_selection(const std::string &caption, const std::vector<std::string> &en
     };
 
     while (!done) {
-        const int cols = termpaint_surface_width(surface);
-        const int rows = termpaint_surface_height(surface);
-
-        int x, y;
-        resolve_align(align, cols_needed, rows_needed, 0, cols, 0, rows, x, y);
-        surface_backup backup(x, y, cols_needed, rows_needed);
+        if(selected < first)
+            first = selected;
+        else if(selected >= first + visible_rows)
+            first = selected - visible_rows + 1;
 
         draw_box_with_caption(x, y, cols_needed, rows_needed, caption);
-        int yy = y+1;
-
-        size_t cur_entry = 0;
-        for(const auto &e: entries) {
-            termpaint_attr *attr = cur_entry == selected ? attributes[ASNormal].highlight : attributes[ASNormal].normal;
-            termpaint_surface_write_with_attr(surface, x+2, yy++, e.c_str(), attr);
-            cur_entry++;
+        for(size_t i = first; i < entries.size() && i < first + visible_rows; i++) {
+            termpaint_attr *attr = i == selected ? attributes[ASNormal].highlight : attributes[ASNormal].normal;
+            termpaint_surface_write_with_attr_clipped(surface, x + 2, y + 1 + (i - first), entries[i].c_str(), attr, x + 2, x + cols_needed - 2);
         }
         termpaint_terminal_flush(terminal, force_repaint);
         force_repaint = false;
@@ -293,6 +415,170 @@ int get_selection(const std::string &caption, const std::vector<std::string> &en
     return selected;
 }
 
+static std::string lowercase(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](char c){ return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; });
+    return str;
+}
+
+static bool is_word_start(const std::string &str, size_t pos)
+{
+    return pos == 0 || !std::isalnum((unsigned char)str[pos - 1]);
+}
+
+// Returns -1 if needle doesn't match. Whole matches score above scattered ones, matches at the
+// start of words above those in the middle, and scattered matches lose points for each gap.
+static int fuzzy_score(const std::string &haystack, const std::string &needle)
+{
+    if(needle.empty())
+        return 0;
+
+    const size_t pos = haystack.find(needle);
+    if(pos != std::string::npos)
+        return 3000 - (pos == 0 ? 0 : is_word_start(haystack, pos) ? 500 : 1000) - (int)std::min<size_t>(pos, 499);
+
+    int score = 1000;
+    size_t h = 0;
+    size_t last = std::string::npos;
+    for(const char c: needle) {
+        h = haystack.find(c, h);
+        if(h == std::string::npos)
+            return -1;
+        if(last != std::string::npos && h != last + 1)
+            score -= std::min<size_t>(h - last, 50);
+        if(is_word_start(haystack, h))
+            score += 10;
+        last = h++;
+    }
+    return std::max(score, 1);
+}
+
+FuzzyMatcher::FuzzyMatcher(const std::vector<std::string> &entries): widest(0)
+{
+    this->entries.reserve(entries.size());
+    matches.reserve(entries.size());
+    for(size_t i = 0; i < entries.size(); i++) {
+        this->entries.push_back(lowercase(entries[i]));
+        widest = std::max(widest, string_width(entries[i]));
+        matches.push_back(i);
+    }
+}
+
+const std::vector<size_t> &FuzzyMatcher::match(const std::string &text)
+{
+    const std::string next_query = lowercase(text);
+    if(next_query == query)
+        return matches;
+
+    // Entries that don't match a query don't match any extension of it either.
+    const bool narrowing = next_query.compare(0, query.size(), query) == 0;
+    if(!narrowing) {
+        matches.resize(entries.size());
+        std::iota(matches.begin(), matches.end(), 0);
+    }
+    query = next_query;
+
+    std::vector<std::pair<int, size_t>> scored;
+    scored.reserve(matches.size());
+    for(const size_t index: matches) {
+        const int score = fuzzy_score(entries[index], query);
+        if(score >= 0)
+            scored.emplace_back(-score, index);
+    }
+    std::sort(scored.begin(), scored.end());
+
+    matches.clear();
+    for(const auto &[score, index]: scored)
+        matches.push_back(index);
+    return matches;
+}
+
+int fuzzy_select(const std::string &caption, FuzzyMatcher &matcher, const std::function<std::string(size_t index)> &label, size_t selected, const Align align)
+{
+    const int cols = termpaint_surface_width(surface);
+    const int rows = termpaint_surface_height(surface);
+
+    // Room for the border, the input and a count behind each entry.
+    const int cols_needed = std::min<int>(cols, std::max(matcher.max_width() + 16, string_width(caption) + 4));
+    const int rows_needed = std::min<int>(rows, matcher.size() + 3);
+    const size_t visible_rows = std::max(rows_needed - 3, 0);
+
+    int x, y;
+    resolve_align(align, cols_needed, rows_needed, 0, cols, 0, rows, x, y);
+    surface_backup backup(x, y, cols_needed, rows_needed);
+
+    std::string query;
+    const std::vector<size_t> *matches = &matcher.match(query);
+    size_t current = std::distance(matches->begin(), std::find(matches->begin(), matches->end(), selected));
+    if(current >= matches->size())
+        current = 0;
+    size_t first = 0;
+
+    const auto set_query = [&](const std::string &text) {
+        query = text;
+        matches = &matcher.match(query);
+        current = 0;
+        first = 0;
+    };
+
+    int result = -1;
+    bool done = false;
+    bool force_repaint = false;
+    std::vector<action> actions = {
+        {TERMPAINT_EV_KEY, "ArrowUp", 0, [&](){ if(current > 0) current--; }, "Previous option"},
+        {TERMPAINT_EV_KEY, "ArrowDown", 0, [&](){ if(current + 1 < matches->size()) current++; }, "Next option"},
+        {TERMPAINT_EV_KEY, "PageUp", 0, [&](){ current -= std::min(current, visible_rows); }, "Previous page"},
+        {TERMPAINT_EV_KEY, "PageDown", 0, [&](){ current = std::min(current + visible_rows, std::max<size_t>(matches->size(), 1) - 1); }, "Next page"},
+        {TERMPAINT_EV_KEY, "Backspace", 0, [&](){
+            size_t end = query.size();
+            while(end > 0 && (query[end - 1] & 0xc0) == 0x80)
+                end--;
+            if(end > 0)
+                set_query(query.substr(0, end - 1));
+        }, "Delete input backward"},
+        {TERMPAINT_EV_KEY, "Escape", 0, [&](){ done = true; }, "Abort selection"},
+        {TERMPAINT_EV_KEY, "Enter", 0, [&](){ if(current < matches->size()) result = (*matches)[current]; done = true; }, "Confirm selection"},
+        {TERMPAINT_EV_CHAR, "l", TERMPAINT_MOD_CTRL, [&](){ force_repaint = true; }, "Force redraw"},
+        {EV_IGNORE, "a..z", 0, nullptr, "Filter options"},
+    };
+
+    termpaint_terminal_set_cursor_visible(terminal, true);
+    termpaint_terminal_set_cursor_style(terminal, TERMPAINT_CURSOR_STYLE_BAR, true);
+    while(!done) {
+        if(current < first)
+            first = current;
+        else if(current >= first + visible_rows)
+            first = current - visible_rows + 1;
+
+        draw_box_with_caption(x, y, cols_needed, rows_needed, caption);
+        const std::string input = "> " + query;
+        termpaint_surface_write_with_attr_clipped(surface, x + 1, y + 1, input.c_str(), attributes[ASNormal].normal, x + 1, x + cols_needed - 2);
+        for(size_t i = first; i < matches->size() && i < first + visible_rows; i++) {
+            termpaint_attr *attr = i == current ? attributes[ASNormal].highlight : attributes[ASNormal].normal;
+            termpaint_surface_write_with_attr_clipped(surface, x + 2, y + 2 + (i - first), label((*matches)[i]).c_str(), attr, x + 2, x + cols_needed - 2);
+        }
+        termpaint_terminal_set_cursor_position(terminal, std::min<int>(x + 1 + string_width(input), x + cols_needed - 2), y + 1);
+
+        termpaint_terminal_flush(terminal, force_repaint);
+        force_repaint = false;
+
+        auto event = wait_for_event(integration, 0);
+        if(!event)
+            abort();
+
+        if(!tui_handle_action(*event, actions) && event->type != EV_TIMEOUT) {
+            if(event->type == TERMPAINT_EV_KEY && event->string == "Space")
+                set_query(query + " ");
+            else if(event->type == TERMPAINT_EV_CHAR && !(event->modifier & TERMPAINT_MOD_CTRL))
+                set_query(query + event->string);
+        }
+    }
+
+    termpaint_terminal_set_cursor_visible(terminal, false);
+    termpaint_terminal_set_cursor_style(terminal, TERMPAINT_CURSOR_STYLE_TERM_DEFAULT, false);
+    return result;
+}
+
 Align operator|(const Align &a, const Align &b)
 {
     return Align((int)a | (int)b);
@@ -308,7 +594,7 @@ Button operator&(const Button &a, const Button &b)
     return Button((int)a & (int)b);
 }
 
-std::string edit_string(const std::string &caption, const std::string &text, const std::string &value, const Align align)
+std::string edit_string(const std::string &caption, const std::string &text, const std::string &value, const Align align, const std::function<void(const std::string &input)> &on_change)
 {
     const int cols = termpaint_surface_width(surface);
     const int rows = termpaint_surface_height(surface);
@@ -360,6 +646,7 @@ std::string edit_string(const std::string &caption, const std::string &text, con
         if(!event)
             abort();
 
+        const std::string previous_input = input;
         if(!tui_handle_action(*event, actions) && event->type != EV_TIMEOUT)
         {
             if(input_pos + 1 == cols_needed - 1)
@@ -373,6 +660,8 @@ std::string edit_string(const std::string &caption, const std::string &text, con
             input.insert(input_pos, event->string);
             input_pos++;
         }
+        if(on_change && !done && input != previous_input)
+            on_change(input);
     }
 
     termpaint_terminal_set_cursor_visible(terminal, false);
@@ -436,8 +725,18 @@ Button message_box(const std::string &caption, const std::string &text, const Bu
         width = std::max(width, string_width(line));
     }
 
-    const size_t rows_needed = 4 + lines.size();
-    const size_t cols_needed = width + 4;
+    const size_t cols = termpaint_surface_width(surface);
+    const size_t rows = termpaint_surface_height(surface);
+    const size_t rows_needed = std::min(4 + lines.size(), rows);
+    const size_t cols_needed = std::min(width + 4, cols);
+    // Longer texts scroll, only the lines from first_line to first_line + visible_lines are drawn.
+    const size_t visible_lines = rows_needed > 4 ? rows_needed - 4 : 0;
+    const size_t max_first_line = lines.size() - std::min(lines.size(), visible_lines);
+    size_t first_line = 0;
+
+    int x, y;
+    resolve_align(align, cols_needed, rows_needed, 0, cols, 0, rows, x, y);
+    surface_backup backup(x, y, cols_needed, rows_needed);
 
     bool done = false;
     bool force_repaint = false;
@@ -455,19 +754,25 @@ Button message_box(const std::string &caption, const std::string &text, const Bu
             {TERMPAINT_EV_CHAR, "l", TERMPAINT_MOD_CTRL, [&](){ force_repaint = true; }, "Force redraw"},
         };
     }
+    if(max_first_line > 0) {
+        actions.insert(actions.end(), {
+            {TERMPAINT_EV_KEY, "ArrowUp", 0, [&](){ if(first_line > 0) first_line--; }, "Scroll up"},
+            {TERMPAINT_EV_KEY, "ArrowDown", 0, [&](){ if(first_line < max_first_line) first_line++; }, "Scroll down"},
+            {TERMPAINT_EV_KEY, "PageUp", 0, [&](){ first_line -= std::min(first_line, visible_lines); }, "Scroll page up"},
+            {TERMPAINT_EV_KEY, "PageDown", 0, [&](){ first_line = std::min(first_line + visible_lines, max_first_line); }, "Scroll page down"},
+        });
+    }
 
     while(!done) {
-        const size_t cols = termpaint_surface_width(surface);
-        const size_t rows = termpaint_surface_height(surface);
-        int x, y;
-        resolve_align(align, cols_needed, rows_needed, 0, cols, 0, rows, x, y);
-        surface_backup backup(x, y, cols_needed, rows_needed);
-
         draw_box_with_caption(x, y, cols_needed, rows_needed, caption);
 
-        for(size_t i=0; i<lines.size(); i++) {
-            termpaint_surface_write_with_attr(surface, x + 2, y + 1 + i, lines[i].c_str(), attributes[ASNormal].normal);
+        for(size_t i = first_line; i < lines.size() && i < first_line + visible_lines; i++) {
+            termpaint_surface_write_with_attr_clipped(surface, x + 2, y + 1 + (i - first_line), lines[i].c_str(), attributes[ASNormal].normal, x + 2, x + cols_needed - 2);
         }
+        if(first_line > 0)
+            termpaint_surface_write_with_attr(surface, x + cols_needed - 1, y + 1, "↑", attributes[ASNormal].normal);
+        if(first_line < max_first_line)
+            termpaint_surface_write_with_attr(surface, x + cols_needed - 1, y + visible_lines, "↓", attributes[ASNormal].normal);
 
         int button_x = x + 2;
         for(size_t btn=0; btn<active_buttons.size(); btn++) {
@@ -504,82 +809,6 @@ void tp_unpause()
     termpaint_terminal_unpause(terminal);
 }
 
-struct progress_info
-{
-    Align align;
-    size_t width, height;
-    std::string caption;
-    int value, maxvalue;
-};
-
-static void draw_progress(progress_info *info)
-{
-    const size_t cols = termpaint_surface_width(surface);
-    const size_t rows = termpaint_surface_height(surface);
-
-    int x, y;
-    resolve_align(info->align, info->width, info->height, 0, cols, 0, rows, x, y);
-
-    draw_box_with_caption(x, y, info->width, info->height, info->caption);
-
-    size_t progress_w = info->width - 4;
-    float progress = info->value / (float)info->maxvalue;
-    int full_blocks = progress_w * progress;
-    int partial_block = ((progress_w * progress) - full_blocks) * 8;
-
-    std::string draw = repeated(full_blocks, "█");
-
-    switch(partial_block) {
-    case 1:
-        draw.append("▏"); break;
-    case 2:
-        draw.append("▎"); break;
-    case 3:
-        draw.append("▍"); break;
-    case 4:
-        draw.append("▌"); break;
-    case 5:
-        draw.append("▋"); break;
-    case 6:
-        draw.append("▊"); break;
-    case 7:
-        draw.append("▉"); break;
-    default:
-        break;
-    }
-
-    termpaint_surface_write_with_attr(surface, x + 2, y + 1, draw.c_str(), attributes[ASNormal].normal);
-    termpaint_terminal_flush(terminal, false);
-}
-
-progress_info* begin_progress(const std::string &caption, const int width, const Align align)
-{
-    progress_info *info = new progress_info;
-
-    info->align = align;
-    info->width = width + 4;
-    info->height = 3;
-    info->caption = caption;
-    info->value = 0;
-    info->maxvalue = 100;
-
-    draw_progress(info);
-
-    return info;
-}
-
-void update_progress(progress_info *info, int value, int maxvalue)
-{
-    info->value = value;
-    info->maxvalue = maxvalue;
-    draw_progress(info);
-}
-
-void end_progress(progress_info *info)
-{
-    delete info;
-}
-
 std::pair<size_t, size_t> string_size(const std::string &str)
 {
     size_t width = 0;
@@ -601,7 +830,7 @@ void write_multiline_string(const int x, const int y, const std::string &str, te
 std::string text_wrap(const std::string &text, const size_t desired_width)
 {
     std::string out;
-    termpaint_text_measurement *m = termpaint_text_measurement_new(surface);
+    termpaint_text_measurement *m = get_measurement();
     size_t cur = 0;
     size_t next = 0;
     do {
@@ -640,7 +869,6 @@ std::string text_wrap(const std::string &text, const size_t desired_width)
         }
         cur = next + 1;
     } while(next != std::string::npos);
-    termpaint_text_measurement_free(m);
     if(out.back() == '\n' && text.back() != '\n')
         out.pop_back();
     return out;
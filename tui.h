@@ -9,6 +9,7 @@
 #include <functional>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct Event {
@@ -31,6 +32,8 @@ enum class Align {
 Align operator|(const Align &a, const Align &b);
 
 extern termpaint_surface *surface;
+// Incremented whenever a box is drawn over the screen, so cached screen content can be discarded.
+extern unsigned int overlay_generation;
 
 enum AttributeSetType {
     ASNormal,
@@ -60,7 +63,11 @@ void tp_shutdown();
 void tp_flush(const bool force=false);
 void tp_pause();
 void tp_unpause();
+// Waits for input, at most timeout milliseconds if it is not 0. Returns EV_TIMEOUT when the
+// timeout expires or tp_wakeup got called.
 std::optional<Event> tp_wait_for_event(int timeout=0);
+// Wakes up tp_wait_for_event. Can be called from any thread.
+void tp_wakeup();
 
 struct action
 {
@@ -73,7 +80,7 @@ struct action
 };
 bool tui_handle_action(const Event &event, const std::vector<action> &actions);
 
-size_t string_width(const std::string &str);
+size_t string_width(std::string_view str);
 std::pair<size_t, size_t> string_size(const std::string &str);
 void write_multiline_string(const int x, const int y, const std::string &str, termpaint_attr *attr);
 std::string text_wrap(const std::string &text, const size_t desired_width);
@@ -81,13 +88,34 @@ std::string text_wrap(const std::string &text, const size_t desired_width);
 Button message_box(const std::string &caption, const std::string &text, const Button buttons=Button::Ok, const Button default_button=Button::Ok, const Align align=Align::Center);
 void draw_box_with_caption(int x, int y, int w, int h, const std::string &caption=std::string());
 int get_selection(const std::string &caption, const std::vector<std::string> &choices, size_t selected=0, const Align align=Align::Center);
-std::string edit_string(const std::string &caption, const std::string &text, const std::string &value, const Align align=Align::Center);
-std::string get_string(const std::string &caption, const std::string &text=std::string(), const Align align=Align::Center);
 
-struct progress_info;
-progress_info* begin_progress(const std::string &caption, const int width, const Align align=Align::Center);
-void update_progress(progress_info *info, const int val, const int maxval);
-void end_progress(progress_info *info);
+// Matches typed text against a fixed list of entries, fuzzy finder style: the characters of the
+// text have to appear in the entry in order. Entries containing the text as a whole rank first.
+// The lowercase entries are prepared once, so it should be kept as long as the entries don't change.
+class FuzzyMatcher
+{
+public:
+    FuzzyMatcher(const std::vector<std::string> &entries);
+
+    size_t size() const { return entries.size(); }
+    size_t max_width() const { return widest; }
+    // Returns the indexes of the matching entries, best first. A query that extends the previous
+    // one only scores the previous matches again.
+    const std::vector<size_t> &match(const std::string &query);
+
+private:
+    std::vector<std::string> entries;
+    size_t widest;
+    std::string query;
+    std::vector<size_t> matches;
+};
+
+// Lets the user narrow down the entries of matcher by typing and returns the index of the chosen
+// one, or -1. Only the visible entries are labeled and drawn.
+int fuzzy_select(const std::string &caption, FuzzyMatcher &matcher, const std::function<std::string(size_t index)> &label, size_t selected=0, const Align align=Align::Center);
+// on_change is called whenever the input changed, e.g. to show a preview of its effect.
+std::string edit_string(const std::string &caption, const std::string &text, const std::string &value, const Align align=Align::Center, const std::function<void(const std::string &input)> &on_change=nullptr);
+std::string get_string(const std::string &caption, const std::string &text=std::string(), const Align align=Align::Center);
 
 void tui_abort(const std::string &message);
 void tui_abort(const char *fmt, ...);
@@ -6,23 +6,37 @@
 #include <curl/curl.h>
 
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "tui.h"
 #include "db.h"
+#include "json_stream.h"
+#include "queries.h"
 
 using json = nlohmann::json;
 struct yt_config yt_config;
 
 UserFlag::UserFlag(sqlite3_stmt *row): id(get_int(row, 0)), name(get_string(row, 1)) {}
 
-void UserFlag::save(sqlite3 *db) const
+void UserFlag::save(sqlite3 *) const
 {
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "UPDATE user_flags SET name = ?2 WHERE flagId = ?1;", -1, &query, nullptr));
-    SC(sqlite3_bind_int(query, 1, id));
-    SC(sqlite3_bind_text(query, 2, name.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    db_write([id = id, name = name](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "UPDATE user_flags SET name = ?2 WHERE flagId = ?1;", &query));
+        SC(sqlite3_bind_int(query, 1, id));
+        SC(sqlite3_bind_text(query, 2, name.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
 }
 
 UserFlag UserFlag::create(sqlite3 *db, const std::string &name)
@@ -32,12 +46,14 @@ UserFlag UserFlag::create(sqlite3 *db, const std::string &name)
         tui_abort("Out of UserFlags...");
     }
 
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "INSERT INTO user_flags(flagId, name) values(?1, ?2);", -1, &query, nullptr));
-    SC(sqlite3_bind_int(query, 1, next_flag));
-    SC(sqlite3_bind_text(query, 2, name.c_str(), -1, nullptr));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "INSERT INTO user_flags(flagId, name) values(?1, ?2);", &query));
+        SC(sqlite3_bind_int(query, 1, next_flag));
+        SC(sqlite3_bind_text(query, 2, name.c_str(), -1, nullptr));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
 
     return UserFlag(next_flag, name);
 }
@@ -46,7 +62,7 @@ int UserFlag::next_free(sqlite3 *db)
 {
     int64_t flag = 1;
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT flagId FROM user_flags ORDER BY flagId;", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT flagId FROM user_flags ORDER BY flagId;", &query));
     while(sqlite3_step(query) == SQLITE_ROW) {
         const int fid = get_int(query, 0);
         if(flag != fid) {
@@ -54,7 +70,7 @@ int UserFlag::next_free(sqlite3 *db)
         }
         flag <<= 1;
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
 
     if(flag > (2L<<32))
         return -1;
@@ -66,18 +82,18 @@ std::vector<UserFlag> UserFlag::get_all(sqlite3 *db)
     std::vector<UserFlag> out;
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT * FROM user_flags ORDER BY flagId;", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT * FROM user_flags ORDER BY flagId;", &query));
     while(sqlite3_step(query) == SQLITE_ROW) {
         out.emplace_back(query);
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
 
     return out;
 }
 
 UserFlag::UserFlag(int id, const std::string &name): id(id), name(name) {}
 
-static size_t curl_writecallback(void *data, size_t size, size_t nmemb, void *userp)
+static size_t curl_writecallback(char *data, size_t size, size_t nmemb, void *userp)
 {
     size_t to_add = size * nmemb;
     std::vector<unsigned char> *buffer = reinterpret_cast<std::vector<unsigned char>*>(userp);
@@ -88,46 +104,125 @@ static size_t curl_writecallback(void *data, size_t size, size_t nmemb, void *us
     return to_add;
 }
 
-static json api_request(const std::string &url, const std::map<std::string, std::string> &params)
+// Long-lived state for all API requests: idle easy handles are kept around and share one
+// connection, DNS and TLS session cache, so consecutive requests reuse warm connections.
+// Requests can be made from several threads, the multi handle is used by one at a time.
+class api_context
 {
-    CURL *curl = curl_easy_init();
-    curl_slist *headers = nullptr;
+public:
+    api_context();
+    ~api_context();
+
+    CURL *acquire();
+    void release(CURL *curl);
+
+    CURLM *multi;
+    std::mutex multi_mutex;
+private:
+    static void lock_share(CURL *, curl_lock_data data, curl_lock_access, void *userp);
+    static void unlock_share(CURL *, curl_lock_data data, void *userp);
+
+    CURLSH *share;
+    std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+    curl_slist *headers;
+    std::mutex idle_mutex;
+    std::vector<CURL*> idle;
+};
+
+static api_context *api = nullptr;
+
+api_context::api_context(): multi(curl_multi_init()), share(curl_share_init()), headers(nullptr)
+{
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
     for(const auto &[header, value]: yt_config.extra_headers) {
         std::string h = header;
         h.append(": ").append(value);
         headers = curl_slist_append(headers, h.c_str());
     }
+}
 
-    CURLU *u = curl_url();
-    curl_url_set(u, CURLUPART_URL, url.c_str(), 0);
-    for(const auto &[k, v]: params) {
-        std::string p = k;
-        p.append("=").append(v);
-        curl_url_set(u, CURLUPART_QUERY, p.c_str(), CURLU_APPENDQUERY|CURLU_URLENCODE);
-    }
-    char *real_url;
-    curl_url_get(u, CURLUPART_URL, &real_url, 0);
+api_context::~api_context()
+{
+    for(CURL *curl: idle)
+        curl_easy_cleanup(curl);
+    curl_multi_cleanup(multi);
+    curl_share_cleanup(share);
+    if(headers)
+        curl_slist_free_all(headers);
+}
 
-    std::vector<unsigned char> data;
+void api_context::lock_share(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+{
+    reinterpret_cast<api_context*>(userp)->share_mutexes[data].lock();
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, real_url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_writecallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
+void api_context::unlock_share(CURL *, curl_lock_data data, void *userp)
+{
+    reinterpret_cast<api_context*>(userp)->share_mutexes[data].unlock();
+}
 
+CURL *api_context::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        if(!idle.empty()) {
+            CURL *curl = idle.back();
+            idle.pop_back();
+            return curl;
+        }
+    }
+
+    CURL *curl = curl_easy_init();
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
     //curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-    curl_easy_perform(curl);
-    curl_free(real_url);
+    return curl;
+}
 
-    data.push_back(0);
+void api_context::release(CURL *curl)
+{
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    idle.push_back(curl);
+}
 
-    long http_response = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response);
+void yt_init()
+{
+    api = new api_context;
+}
 
-    curl_url_cleanup(u);
-    curl_easy_cleanup(curl);
-    if(headers)
-        curl_slist_free_all(headers);
+void yt_shutdown()
+{
+    delete api;
+    api = nullptr;
+}
+
+static void setup_request(CURL *curl, const std::string &url, const std::map<std::string, std::string> &params, curl_write_callback write_callback, void *data)
+{
+    std::string real_url = url;
+    char separator = '?';
+    for(const auto &[k, v]: params) {
+        char *value = curl_easy_escape(curl, v.c_str(), v.size());
+        real_url.append(1, separator).append(k).append("=").append(value);
+        curl_free(value);
+        separator = '&';
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, real_url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+}
+
+static json parse_response(std::vector<unsigned char> &data)
+{
+    data.push_back(0);
 
     try {
         return json::parse(data);
@@ -137,17 +232,49 @@ static json api_request(const std::string &url, const std::map<std::string, std:
     return {};
 }
 
-Channel::Channel(sqlite3_stmt *row): id(get_string(row, 0)), name(get_string(row, 1)), is_virtual(false),
-    user_flags(get_int(row, 2)), unwatched(0), tui_name_width(0)
+static json api_request(const std::string &url, const std::map<std::string, std::string> &params)
+{
+    CURL *curl = api->acquire();
+    std::vector<unsigned char> data;
+
+    setup_request(curl, url, params, curl_writecallback, &data);
+    curl_easy_perform(curl);
+    api->release(curl);
+
+    return parse_response(data);
+}
+
+// The keys point into channel_slot_ids, a deque doesn't move its elements when growing.
+static std::unordered_map<std::string_view, int> channel_slots;
+static std::deque<std::string> channel_slot_ids;
+
+int get_channel_slot(std::string_view channel_id)
+{
+    const auto it = channel_slots.find(channel_id);
+    if(it != channel_slots.end())
+        return it->second;
+
+    const int slot = channel_slot_ids.size();
+    channel_slots.emplace(channel_slot_ids.emplace_back(channel_id), slot);
+    return slot;
+}
+
+const std::string &get_channel_id(int slot)
+{
+    return channel_slot_ids.at(slot);
+}
+
+Channel::Channel(sqlite3_stmt *row): id(get_string(row, 0)), slot(get_channel_slot(id)), name(get_string(row, 1)),
+    is_virtual(false), user_flags(get_int(row, 2)), tui_name_width(0)
 {
 }
 
-Channel::Channel(const std::string &id, const std::string &name): id(id), name(name), is_virtual(false),
-    user_flags(0), unwatched(0), tui_name_width(0)
+Channel::Channel(const std::string &id, const std::string &name): id(id), slot(get_channel_slot(id)), name(name),
+    is_virtual(false), user_flags(0), tui_name_width(0)
 {
 }
 
-Channel Channel::add(sqlite3 *db, const std::string &selector, const std::string &value)
+Channel Channel::add(sqlite3 *, const std::string &selector, const std::string &value)
 {
     std::map<std::string, std::string> params = {
         {"part", "snippet"},
@@ -155,7 +282,7 @@ Channel Channel::add(sqlite3 *db, const std::string &selector, const std::string
         {"key", yt_config.api_key},
     };
 
-    const json response = api_request("https://content.googleapis.com/youtube/v3/channels", params);
+    const json response = api_request(yt_config.api_url + "channels", params);
 
     // Error responses dont have pageInfo items
     if(!response.count("pageInfo")) {
@@ -172,12 +299,14 @@ Channel Channel::add(sqlite3 *db, const std::string &selector, const std::string
     const std::string channel_id = response["items"][0]["id"];
     const std::string channel_name = response["items"][0]["snippet"]["title"];
 
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "INSERT INTO channels(channelId, name, user_flags) VALUES(?1, ?2, 0);", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, channel_id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 2, channel_name.c_str(), -1, SQLITE_TRANSIENT));
-    sqlite3_step(query);
-    SC(sqlite3_finalize(query));
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "INSERT INTO channels(channelId, name, user_flags) VALUES(?1, ?2, 0);", &query));
+        SC(sqlite3_bind_text(query, 1, channel_id.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_text(query, 2, channel_name.c_str(), -1, SQLITE_TRANSIENT));
+        sqlite3_step(query);
+        SC(db_release(query));
+    });
 
     return Channel(channel_id, channel_name);
 }
@@ -192,16 +321,25 @@ Channel Channel::add_virtual(const std::string &name, const ChannelFilter &filte
     return channel;
 }
 
+Channel Channel::add_search(const std::string &name, const std::string &search)
+{
+    // Not derived from the name like for filters, so a filter of the same name is a different channel.
+    Channel channel("search", name);
+    channel.is_virtual = true;
+    channel.search = search;
+    return channel;
+}
+
 std::vector<Channel> Channel::get_all(sqlite3 *db)
 {
     std::vector<Channel> channels;
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT * FROM channels;", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT * FROM channels;", &query));
     while(sqlite3_step(query) == SQLITE_ROW) {
         channels.emplace_back(query);
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
 
     return channels;
 }
@@ -211,134 +349,1073 @@ std::string Channel::upload_playlist() const
     return "UU" + id.substr(2);
 }
 
-bool video_is_known(sqlite3 *db, const std::string &channel_id, const std::string &video_id)
+// Canonical video ids are 11 base64url characters where the last one only carries 4 bits,
+// so they fit exactly into 64 bits.
+static bool pack_video_id(const std::string &video_id, uint64_t &packed)
+{
+    if(video_id.size() != 11)
+        return false;
+
+    packed = 0;
+    for(size_t i=0; i<video_id.size(); i++) {
+        const char c = video_id[i];
+        uint64_t value;
+        if(c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if(c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if(c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if(c == '-')
+            value = 62;
+        else if(c == '_')
+            value = 63;
+        else
+            return false;
+
+        if(i + 1 < video_id.size()) {
+            packed = (packed << 6) | value;
+        } else {
+            if(value & 0x3)
+                return false;
+            packed = (packed << 4) | (value >> 2);
+        }
+    }
+    return true;
+}
+
+class known_video_index
+{
+public:
+    bool contains(const std::string &video_id) const
+    {
+        uint64_t id;
+        if(pack_video_id(video_id, id))
+            return packed.count(id);
+        return other.count(video_id);
+    }
+
+    void insert(const std::string &video_id)
+    {
+        uint64_t id;
+        if(pack_video_id(video_id, id))
+            packed.insert(id);
+        else
+            other.insert(video_id);
+    }
+
+    size_t size() const
+    {
+        return packed.size() + other.size();
+    }
+
+    std::unordered_set<uint64_t> packed;
+    std::unordered_set<std::string> other; // Ids that don't follow the usual format
+};
+
+// Known video ids per channel, loaded on first use. The spill file keeps them across restarts
+// for large databases; it is only trusted while the videos generation of the database matches the
+// one it was written for, i.e. as long as no videos were added or removed without updating it.
+// Refreshes run on a worker thread, so all of this is guarded by known_videos_mutex.
+static std::mutex known_videos_mutex;
+static std::unordered_map<std::string, known_video_index> known_videos;
+static std::string known_videos_filename;
+static int64_t known_videos_file_generation = -1;
+static std::unordered_map<std::string, std::streamoff> known_videos_file_offsets;
+static bool known_videos_dirty = false;
+static constexpr char known_videos_magic[8] = {'y', 't', 'k', 'n', 'o', 'w', 'n', '2'};
+static constexpr size_t known_videos_spill_threshold = 10000;
+
+template<typename T>
+static bool read_value(std::istream &is, T &value)
+{
+    return bool(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template<typename T>
+static void write_value(std::ostream &os, const T &value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Counts read from the file are checked against its size before anything is allocated for them.
+static uint64_t bytes_left(std::istream &is)
+{
+    const std::streamoff pos = is.tellg();
+    is.seekg(0, std::ios::end);
+    const std::streamoff end = is.tellg();
+    is.seekg(pos);
+    return pos < 0 || end < pos ? 0 : uint64_t(end - pos);
+}
+
+// The smallest size the ids of a channel can take.
+static uint64_t known_videos_min_size(uint32_t packed_count, uint32_t other_count)
+{
+    return uint64_t(packed_count) * sizeof(uint64_t) + uint64_t(other_count) * sizeof(uint32_t);
+}
+
+static bool read_string(std::istream &is, std::string &str)
+{
+    uint32_t length;
+    if(!read_value(is, length) || length > bytes_left(is))
+        return false;
+    str.resize(length);
+    return bool(is.read(str.data(), length));
+}
+
+static void write_string(std::ostream &os, const std::string &str)
+{
+    write_value(os, uint32_t(str.size()));
+    os.write(str.data(), str.size());
+}
+
+// Triggers bump the generation in the same transaction that adds or removes videos. It starts at a
+// random value, so a new database doesn't match the file of an old one.
+static int64_t videos_generation(sqlite3 *db)
 {
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT 1 FROM videos WHERE channelId=?1 AND videoId=?2 LIMIT 1;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, channel_id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 2, video_id.c_str(), -1, SQLITE_TRANSIENT));
+    SC(db_prepare(db, "SELECT CAST(value AS INTEGER) FROM settings WHERE key = 'videos_generation';", &query));
+    int64_t generation = -1;
+    if(sqlite3_step(query) == SQLITE_ROW)
+        generation = sqlite3_column_int64(query, 0);
+    SC(db_release(query));
+    return generation;
+}
 
-    bool known = false;
-    const int res = sqlite3_step(query);
-    if(res == SQLITE_ROW) {
-        known =  sqlite3_column_int(query, 0) > 0;
-    } else if(res == SQLITE_DONE) {
-        known = false;
+void known_videos_open(sqlite3 *db, const std::string &filename)
+{
+    std::lock_guard<std::mutex> lock(known_videos_mutex);
+    known_videos.clear();
+    known_videos_file_offsets.clear();
+    known_videos_filename = filename;
+    known_videos_file_generation = -1;
+    known_videos_dirty = false;
+
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!ifs.is_open())
+        return;
+
+    char magic[sizeof(known_videos_magic)];
+    int64_t generation;
+    uint32_t channel_count;
+    if(!ifs.read(magic, sizeof(magic)) || memcmp(magic, known_videos_magic, sizeof(magic)) != 0)
+        return;
+    if(!read_value(ifs, generation) || !read_value(ifs, channel_count))
+        return;
+    if(generation < 0 || generation != videos_generation(db))
+        return;
+
+    // Only remember where each channel starts, the ids are read when the channel is first needed.
+    std::unordered_map<std::string, std::streamoff> offsets;
+    for(uint32_t c=0; c<channel_count; c++) {
+        std::string channel_id;
+        uint32_t packed_count, other_count;
+        if(!read_string(ifs, channel_id))
+            return;
+        const std::streamoff offset = ifs.tellg();
+        if(!read_value(ifs, packed_count) || !read_value(ifs, other_count))
+            return;
+        if(known_videos_min_size(packed_count, other_count) > bytes_left(ifs))
+            return;
+        ifs.seekg(packed_count * sizeof(uint64_t), std::ios::cur);
+        for(uint32_t i=0; i<other_count; i++) {
+            std::string id;
+            if(!read_string(ifs, id))
+                return;
+        }
+        offsets.emplace(channel_id, offset);
     }
-    SC(sqlite3_finalize(query));
 
-    return known;
+    known_videos_file_generation = generation;
+    known_videos_file_offsets = std::move(offsets);
 }
 
-void add_video(sqlite3 *db, const json &snippet, const json &content_details, const std::string &channel_id) {
-    const std::string video_id = snippet["resourceId"]["videoId"];
-    const std::string title = snippet["title"];
-    const std::string description = snippet["description"];
-    const int flags = 0;
-    const std::string added_to_playlist = snippet["publishedAt"];
-    const std::string published = content_details["videoPublishedAt"];
+static bool load_known_videos_from_file(const std::string &channel_id, known_video_index &index)
+{
+    const auto it = known_videos_file_offsets.find(channel_id);
+    if(it == known_videos_file_offsets.end())
+        return false;
+
+    std::ifstream ifs(known_videos_filename, std::ios::binary);
+    uint32_t packed_count, other_count;
+    if(!ifs.seekg(it->second) || !read_value(ifs, packed_count) || !read_value(ifs, other_count))
+        return false;
+    if(known_videos_min_size(packed_count, other_count) > bytes_left(ifs))
+        return false;
+
+    std::vector<uint64_t> packed(packed_count);
+    if(!ifs.read(reinterpret_cast<char*>(packed.data()), packed_count * sizeof(uint64_t)))
+        return false;
+    index.packed.reserve(packed_count);
+    index.packed.insert(packed.cbegin(), packed.cend());
+    for(uint32_t i=0; i<other_count; i++) {
+        std::string id;
+        if(!read_string(ifs, id))
+            return false;
+        index.other.insert(id);
+    }
+    return true;
+}
 
+static known_video_index &known_videos_for_channel(sqlite3 *db, const std::string &channel_id)
+{
+    auto it = known_videos.find(channel_id);
+    if(it != known_videos.end())
+        return it->second;
+
+    known_video_index &index = known_videos[channel_id];
+    if(known_videos_file_generation >= 0 && load_known_videos_from_file(channel_id, index))
+        return index;
+
+    index = known_video_index();
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "INSERT INTO videos (videoId, channelId, title, description, flags, added_to_playlist, published) values(?1,?2,?3,?4,?5,?6,?7);", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, video_id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 2, channel_id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 3, title.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 4, description.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_int(query, 5, flags));
-    SC(sqlite3_bind_text(query, 6, added_to_playlist.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_text(query, 7, published.c_str(), -1, SQLITE_TRANSIENT));
-    sqlite3_step(query);
-    SC(sqlite3_finalize(query));
+    SC(db_prepare(db, known_videos_sql, &query));
+    SC(sqlite3_bind_text(query, 1, channel_id.c_str(), -1, SQLITE_TRANSIENT));
+    while(sqlite3_step(query) == SQLITE_ROW) {
+        index.insert(get_string(query, 0));
+    }
+    SC(db_release(query));
+
+    if(index.size())
+        known_videos_dirty = true;
+    return index;
 }
 
+void known_videos_save(sqlite3 *db)
+{
+    if(known_videos_filename.empty())
+        return;
 
-int Channel::fetch_new_videos(sqlite3 *db, progress_info *info, std::optional<std::string> after, std::optional<int> max_count) const
+    std::lock_guard<std::mutex> lock(known_videos_mutex);
+    db_sync();
+    const int64_t generation = videos_generation(db);
+    if(!known_videos_dirty && generation == known_videos_file_generation)
+        return;
+
+    // Channels that were never needed in this session are carried over from the old file.
+    if(known_videos_file_generation >= 0) {
+        for(const auto &[channel_id, offset]: known_videos_file_offsets) {
+            if(!known_videos.count(channel_id))
+                known_videos_for_channel(db, channel_id);
+        }
+    }
+
+    size_t total = 0;
+    for(const auto &[channel_id, index]: known_videos)
+        total += index.size();
+    if(total < known_videos_spill_threshold) {
+        std::remove(known_videos_filename.c_str());
+        known_videos_file_generation = -1;
+        known_videos_file_offsets.clear();
+        return;
+    }
+
+    const std::string tmp_filename = known_videos_filename + ".tmp";
+    std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+    if(!ofs.is_open())
+        return;
+
+    std::unordered_map<std::string, std::streamoff> offsets;
+    ofs.write(known_videos_magic, sizeof(known_videos_magic));
+    write_value(ofs, generation);
+    write_value(ofs, uint32_t(known_videos.size()));
+    for(const auto &[channel_id, index]: known_videos) {
+        write_string(ofs, channel_id);
+        offsets.emplace(channel_id, ofs.tellp());
+        write_value(ofs, uint32_t(index.packed.size()));
+        write_value(ofs, uint32_t(index.other.size()));
+        for(const uint64_t id: index.packed)
+            write_value(ofs, id);
+        for(const std::string &id: index.other)
+            write_string(ofs, id);
+    }
+    ofs.close();
+
+    if(!ofs || std::rename(tmp_filename.c_str(), known_videos_filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        return;
+    }
+    known_videos_file_generation = generation;
+    known_videos_file_offsets = std::move(offsets);
+    known_videos_dirty = false;
+}
+
+bool video_is_known(sqlite3 *db, const std::string &channel_id, const std::string &video_id)
 {
-    const std::string playlist_id = upload_playlist();
-    std::map<std::string, std::string> params = {
+    std::lock_guard<std::mutex> lock(known_videos_mutex);
+    return known_videos_for_channel(db, channel_id).contains(video_id);
+}
+
+// The parts of a playlistItems entry that get stored.
+struct playlist_item
+{
+    std::string video_id;
+    std::string channel_id;
+    std::string title;
+    std::string description;
+    std::string added_to_playlist;
+    std::string published;
+
+    void clear()
+    {
+        video_id.clear();
+        channel_id.clear();
+        title.clear();
+        description.clear();
+        added_to_playlist.clear();
+        published.clear();
+    }
+};
+
+// Collects new videos and hands them to the writer thread in batches, which inserts them with one
+// reused statement. The strings are bound without copying, the batch owns them until it is
+// written. Videos that are already stored are skipped by SQLite.
+class video_inserter
+{
+public:
+    video_inserter(sqlite3 *db): db(db) {}
+    ~video_inserter() { flush(); }
+
+    void add(playlist_item &item);
+    void flush();
+    // Flushes and waits until the videos are stored. Only then are they added to the known videos,
+    // so a failed batch doesn't leave them marked as known. Fails like db_sync.
+    void commit();
+
+    static constexpr size_t batch_size = 500;
+
+private:
+    sqlite3 *db;
+    std::vector<playlist_item> pending;
+    // Channel and video ids of the flushed videos that are not known yet.
+    std::vector<std::pair<std::string, std::string>> flushed;
+};
+
+void video_inserter::add(playlist_item &item)
+{
+    pending.push_back(std::move(item));
+    if(pending.size() >= batch_size)
+        flush();
+}
+
+void video_inserter::flush()
+{
+    if(pending.empty())
+        return;
+
+    for(const playlist_item &item: pending)
+        flushed.emplace_back(item.channel_id, item.video_id);
+    db_write([items = std::move(pending)](sqlite3 *db) {
+        const int flags = 0;
+        sqlite3_stmt *query;
+        SC(db_prepare(db, R"(INSERT INTO videos (videoId, channelId, title, description, flags, added_to_playlist, published, sort_key)
+                             values(?1,?2,?3,?4,?5,?6,?7,coalesce(CAST(strftime('%s', coalesce(nullif(?7, ''), ?6)) AS INTEGER), 0))
+                             ON CONFLICT(videoId) DO NOTHING;)", &query));
+        for(const playlist_item &item: items) {
+            SC(sqlite3_bind_text(query, 1, item.video_id.c_str(), item.video_id.size(), SQLITE_STATIC));
+            SC(sqlite3_bind_text(query, 2, item.channel_id.c_str(), item.channel_id.size(), SQLITE_STATIC));
+            SC(sqlite3_bind_text(query, 3, item.title.c_str(), item.title.size(), SQLITE_STATIC));
+            SC(sqlite3_bind_text(query, 4, item.description.c_str(), item.description.size(), SQLITE_STATIC));
+            SC(sqlite3_bind_int(query, 5, flags));
+            SC(sqlite3_bind_text(query, 6, item.added_to_playlist.c_str(), item.added_to_playlist.size(), SQLITE_STATIC));
+            SC(sqlite3_bind_text(query, 7, item.published.c_str(), item.published.size(), SQLITE_STATIC));
+            SC(sqlite3_step(query));
+            SC(sqlite3_reset(query));
+        }
+        SC(db_release(query));
+    });
+    pending.clear();
+}
+
+void video_inserter::commit()
+{
+    flush();
+    // Holding the lock while waiting keeps known_videos_save from writing a file for the new
+    // generation without these videos.
+    std::lock_guard<std::mutex> lock(known_videos_mutex);
+    db_sync();
+    for(const auto &[channel_id, video_id]: flushed)
+        known_videos_for_channel(db, channel_id).insert(video_id);
+    if(!flushed.empty())
+        known_videos_dirty = true;
+    flushed.clear();
+}
+
+// Picks the interesting fields out of a streamed playlistItems response. Each item is passed on
+// as soon as its closing brace arrives, so the rest of the response can be skipped once an item
+// is rejected.
+class playlist_page_handler: public json_stream_handler
+{
+public:
+    std::function<bool(playlist_item &item)> on_item;
+
+    bool has_page_info;
+    std::string next_page_token;
+
+    void reset()
+    {
+        path.clear();
+        current_key.clear();
+        item.clear();
+        has_page_info = false;
+        next_page_token.clear();
+    }
+
+    bool begin_object() override
+    {
+        if(path.size() == 1 && current_key == "pageInfo")
+            has_page_info = true;
+        path.push_back(current_key);
+        return true;
+    }
+    bool end_object() override
+    {
+        const bool item_done = in_items() && path.size() == 3;
+        path.pop_back();
+        if(item_done) {
+            const bool ok = on_item(item);
+            item.clear();
+            return ok;
+        }
+        return true;
+    }
+    bool begin_array() override
+    {
+        path.push_back(current_key);
+        current_key.clear();
+        return true;
+    }
+    bool end_array() override
+    {
+        path.pop_back();
+        return true;
+    }
+    bool key(const std::string &k) override
+    {
+        current_key = k;
+        return true;
+    }
+    bool string(const std::string &value) override
+    {
+        if(path.size() == 1) {
+            if(current_key == "nextPageToken")
+                next_page_token = value;
+        } else if(in_items() && path.size() == 4 && path[3] == "snippet") {
+            if(current_key == "title")
+                item.title = value;
+            else if(current_key == "description")
+                item.description = value;
+            else if(current_key == "channelId")
+                item.channel_id = value;
+            else if(current_key == "publishedAt")
+                item.added_to_playlist = value;
+        } else if(in_items() && path.size() == 5 && path[3] == "snippet" && path[4] == "resourceId") {
+            if(current_key == "videoId")
+                item.video_id = value;
+        } else if(in_items() && path.size() == 4 && path[3] == "contentDetails") {
+            if(current_key == "videoPublishedAt")
+                item.published = value;
+        }
+        return true;
+    }
+
+private:
+    // path holds the key of every open container, the root being path[0].
+    bool in_items() const
+    {
+        return path.size() >= 3 && path[1] == "items";
+    }
+
+    std::vector<std::string> path;
+    std::string current_key;
+    playlist_item item;
+};
+
+struct channel_refresh
+{
+    channel_refresh(): parser(handler) {}
+
+    sqlite3 *db;
+    video_inserter *inserter;
+    size_t index;
+    // The handle of the page request in flight, if any.
+    CURL *curl = nullptr;
+    std::map<std::string, std::string> params;
+    std::optional<int> max_count;
+    int processed;
+    bool stop;
+    // Why the refresh failed, the videos found until then are kept. Database errors end the
+    // refresh of all channels, the others only that of this one.
+    std::string error;
+    bool database_failed = false;
+
+    playlist_page_handler handler;
+    json_stream_parser parser;
+
+    void begin(sqlite3 *db, video_inserter *inserter, const Channel &channel, std::optional<int> max_count);
+    bool add_item(playlist_item &item);
+    void begin_page();
+    bool end_page(CURLcode result);
+};
+
+void channel_refresh::begin(sqlite3 *db, video_inserter *inserter, const Channel &channel, std::optional<int> max_count)
+{
+    this->db = db;
+    this->inserter = inserter;
+    this->max_count = max_count;
+    params = {
         {"part", "snippet,contentDetails"},
-        {"playlistId", playlist_id},
+        {"playlistId", channel.upload_playlist()},
         {"maxResults", "50"},
         {"key", yt_config.api_key},
     };
+    processed = 0;
+    stop = false;
+    error.clear();
+    database_failed = false;
+    handler.on_item = [this](playlist_item &item) { return add_item(item); };
+}
 
-    db_transaction transaction;
+// Returns false to stop at this video.
+bool channel_refresh::add_item(playlist_item &item)
+{
+    if(video_is_known(db, item.channel_id, item.video_id)) {
+        //fprintf(stderr, "Stopping at video '%s': Already known.\r\n", item.title.c_str());
+        stop = true;
+        return false;
+    }
 
-    int processed = 0;
-    bool abort = false;
-    while(true) {
-        const json response = api_request("https://content.googleapis.com/youtube/v3/playlistItems", params);
+    //fprintf(stderr, "New video: '%s': %s.\r\n", item.title.c_str(), item.video_id.c_str());
+    inserter->add(item);
+    processed++;
+    if(max_count && processed >= *max_count) {
+        stop = true;
+        return false;
+    }
+    return true;
+}
 
-        if(response.empty() || !response.count("pageInfo")) // TODO: Better API error detection/handling. For now just break if there is no pageInfo field.
-            break;
+void channel_refresh::begin_page()
+{
+    handler.reset();
+    parser.reset();
+}
 
-        for(auto &item: response["items"]) {
-            auto snippet = item["snippet"];
-            auto content_details = item["contentDetails"];
-            std::string channel_id = snippet["channelId"];
-            std::string video_id = snippet["resourceId"]["videoId"];
-            std::string title = snippet["title"];
-
-            if(after) {
-                auto addedToPlaylistAt = snippet["publishedAt"];
-                auto publishedAt = content_details["videoPublishedAt"];
-                if(addedToPlaylistAt < *after) {
-                    //fprintf(stderr, "Stopping at video '%s': Too old.\r\n", title.c_str());
-                    abort = true;
-                    break;
-                }
-            }
+// Returns true if the next page should be fetched. Sets error if the page couldn't be loaded.
+bool channel_refresh::end_page(CURLcode result)
+{
+    if(stop || !error.empty())
+        return false;
+
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    // The write callback aborts the transfer if the response can't be parsed, which is expected
+    // for error pages.
+    if(result != CURLE_OK && result != CURLE_WRITE_ERROR)
+        error = curl_easy_strerror(result);
+    else if(status != 200)
+        error = "The YouTube API answered with HTTP status " + std::to_string(status) + ".";
+    else if(result != CURLE_OK || parser.finish() != json_stream_parser::Status::Ok)
+        error = "Failed to parse YouTube API response.";
+    if(!error.empty())
+        return false;
+
+    if(!handler.has_page_info) // TODO: Better API error detection/handling. For now just break if there is no pageInfo field.
+        return false;
+
+    if(handler.next_page_token.empty())
+        return false;
+    params["pageToken"] = handler.next_page_token;
+    //fprintf(stderr, "Processed %d. Next page...\r\n", processed);
+    return true;
+}
+
+static size_t curl_streamcallback(char *data, size_t size, size_t nmemb, void *userp)
+{
+    channel_refresh *refresh = reinterpret_cast<channel_refresh*>(userp);
+    try {
+        // A page that can't be parsed aborts the transfer. The rest of a page that stops at a known
+        // video is still read and dropped, aborting would close the connection and the next
+        // request would need a new TCP and TLS handshake.
+        if(refresh->parser.feed(data, size * nmemb) == json_stream_parser::Status::Error)
+            return 0;
+    } catch(const db_error &err) {
+        // Must not pass through curl, it is thrown again once the transfers are cleaned up.
+        refresh->error = err.what();
+        refresh->database_failed = true;
+        return 0;
+    }
+    return size * nmemb;
+}
+
+static void start_page_request(CURL *curl, channel_refresh &refresh)
+{
+    refresh.begin_page();
+    setup_request(curl, yt_config.api_url + "playlistItems", refresh.params, curl_streamcallback, &refresh);
+}
+
+std::vector<int> Channel::fetch_new_videos_parallel(sqlite3 *db, const std::vector<const Channel*> &channels, std::vector<std::string> &errors, const std::function<bool(size_t, size_t)> &progress, std::optional<int> max_count)
+{
+    std::vector<int> new_videos(channels.size(), 0);
+    errors.assign(channels.size(), std::string());
+    if(channels.empty())
+        return new_videos;
+
+    const size_t concurrency = std::max(1, yt_config.refresh_concurrency);
+    std::vector<channel_refresh> refreshes(channels.size());
+    std::lock_guard<std::mutex> lock(api->multi_mutex);
+    CURLM *multi = api->multi;
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, long(concurrency));
+
+    video_inserter inserter(db);
+
+    const auto start_request = [&](channel_refresh &refresh, CURL *curl) {
+        refresh.curl = curl;
+        start_page_request(curl, refresh);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)&refresh);
+        curl_multi_add_handle(multi, curl);
+    };
+
+    size_t next_channel = 0;
+    size_t active = 0;
+    size_t done = 0;
+    const auto start_next_channel = [&]() {
+        channel_refresh &refresh = refreshes[next_channel];
+        refresh.index = next_channel;
+        refresh.begin(db, &inserter, *channels[next_channel], max_count);
+        start_request(refresh, api->acquire());
+        next_channel++;
+        active++;
+    };
 
-            if(video_is_known(db, channel_id, video_id)) {
-                //fprintf(stderr, "Stopping at video '%s': Already known.\r\n", title.c_str());
-                abort = true;
-                break;
+    while(next_channel < channels.size() && active < concurrency)
+        start_next_channel();
+
+    while(active > 0) {
+        if(progress && !progress(done, channels.size())) {
+            // Cancelled, the videos found so far are still stored.
+            for(channel_refresh &refresh: refreshes) {
+                if(!refresh.curl)
+                    continue;
+                curl_multi_remove_handle(multi, refresh.curl);
+                api->release(refresh.curl);
+                refresh.curl = nullptr;
+                new_videos[refresh.index] = refresh.processed;
             }
+            break;
+        }
 
-            add_video(db, snippet, content_details, channel_id);
-            //fprintf(stderr, "New video: '%s': %s.\r\n", title.c_str(), video_id.c_str());
-            processed++;
-            if(max_count && processed >= *max_count) {
-                abort = true;
-                break;
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        int queued = 0;
+        while(CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+            if(msg->msg != CURLMSG_DONE)
+                continue;
+
+            CURL *curl = msg->easy_handle;
+            const CURLcode result = msg->data.result;
+            channel_refresh *refresh = nullptr;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, &refresh);
+            curl_multi_remove_handle(multi, curl);
+
+            bool next_page = false;
+            try {
+                next_page = refresh->end_page(result);
+            } catch(const db_error &err) {
+                refresh->error = err.what();
+                refresh->database_failed = true;
+            }
+            if(next_page) {
+                start_request(*refresh, curl);
+                continue;
             }
+
+            api->release(curl);
+            refresh->curl = nullptr;
+            new_videos[refresh->index] = refresh->processed;
+            errors[refresh->index] = refresh->error;
+            active--;
+            done++;
+            if(next_channel < channels.size())
+                start_next_channel();
         }
 
-        const json page_info = response["pageInfo"];
-        const int results = page_info["totalResults"];
-        if(info)
-            update_progress(info, processed, results);
+        if(active > 0)
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+    inserter.commit();
+    for(const channel_refresh &refresh: refreshes) {
+        if(refresh.database_failed)
+            throw db_error(refresh.error);
+    }
 
-        if(!abort && response.count("nextPageToken")) {
-            params["pageToken"] = response["nextPageToken"];
-            //fprintf(stderr, "Processed %d. Next page...\r\n", processed);
-        } else {
-            break;
+    return new_videos;
+}
+
+void VideoCounts::load(sqlite3 *db)
+{
+    groups_by_slot.clear();
+
+    sqlite3_stmt *query;
+    SC(db_prepare(db, "SELECT channelId, flags, count(*) FROM videos GROUP BY channelId, flags;", &query));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        add(get_channel_slot(get_string_view(query, 0)), sqlite3_column_int(query, 1), sqlite3_column_int(query, 2));
+    SC(db_release(query));
+}
+
+void VideoCounts::add(int slot, int flags, int count)
+{
+    if(size_t(slot) >= groups_by_slot.size())
+        groups_by_slot.resize(slot + 1);
+    groups_by_slot[slot][flags] += count;
+}
+
+void VideoCounts::change_flags(int slot, int old_flags, int new_flags, int count)
+{
+    add(slot, old_flags, -count);
+    add(slot, new_flags, count);
+}
+
+size_t VideoCounts::count(const Channel &channel, const std::vector<Channel> &channels, uint32_t mask, uint32_t value) const
+{
+    const auto count_slot = [&](int slot, uint32_t video_mask, uint32_t video_value) {
+        size_t count = 0;
+        if(size_t(slot) < groups_by_slot.size()) {
+            for(const auto &[flags, videos]: groups_by_slot[slot]) {
+                if((flags & video_mask) == video_value && (flags & mask) == value)
+                    count += videos;
+            }
         }
+        return count;
+    };
+
+    if(!channel.is_virtual)
+        return count_slot(channel.slot, 0, 0);
+    // The matches of a search are not grouped.
+    if(channel.search)
+        return 0;
+
+    const ChannelFilter &filter = channel.filter;
+    size_t count = 0;
+    if(filter.user_mask) {
+        for(const Channel &other: channels) {
+            if(!other.is_virtual && (other.user_flags & filter.user_mask) == filter.user_value)
+                count += count_slot(other.slot, filter.video_mask, filter.video_value);
+        }
+    } else {
+        for(size_t slot = 0; slot < groups_by_slot.size(); slot++)
+            count += count_slot(slot, filter.video_mask, filter.video_value);
     }
+    return count;
+}
 
-    return processed;
+void VideoFlagIndex::load(sqlite3 *db, const std::vector<Channel> &channels)
+{
+    *this = VideoFlagIndex();
+    for(const Channel &channel: channels) {
+        if(channel.is_virtual)
+            continue;
+        if(size_t(channel.slot) >= user_flags_by_slot.size())
+            user_flags_by_slot.resize(channel.slot + 1);
+        user_flags_by_slot[channel.slot] = channel.user_flags;
+    }
+
+    sqlite3_stmt *query;
+    SC(db_prepare(db, flag_index_sql, &query));
+    SC(sqlite3_bind_int64(query, 1, 0));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        append(query);
+    SC(db_release(query));
+    sort();
 }
 
-void Channel::load_info(sqlite3 *db)
+std::map<std::pair<int, int>, int> VideoFlagIndex::update(sqlite3 *db)
 {
-    unwatched = 0;
+    std::map<std::pair<int, int>, int> counts;
+    VideoFlagIndex added;
+    added.user_flags_by_slot = user_flags_by_slot;
 
-    if(is_virtual) {
-        return;
+    sqlite3_stmt *query;
+    SC(db_prepare(db, flag_index_sql, &query));
+    SC(sqlite3_bind_int64(query, 1, max_rowid));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        added.append(query);
+    SC(db_release(query));
+    if(added.timestamps.empty())
+        return counts;
+    for(size_t i = 0; i < added.slots.size(); i++)
+        counts[{added.slots[i], int(added.video_flags[i])}]++;
+    added.sort();
+
+    // Both are sorted, merging them keeps the order.
+    VideoFlagIndex merged;
+    const size_t size = timestamps.size() + added.timestamps.size();
+    merged.timestamps.reserve(size);
+    merged.video_rowids.reserve(size);
+    merged.slots.reserve(size);
+    merged.video_flags.reserve(size);
+    merged.channel_flags.reserve(size);
+    const auto take = [&merged](const VideoFlagIndex &from, size_t &index) {
+        merged.timestamps.push_back(from.timestamps[index]);
+        merged.video_rowids.push_back(from.video_rowids[index]);
+        merged.slots.push_back(from.slots[index]);
+        merged.video_flags.push_back(from.video_flags[index]);
+        merged.channel_flags.push_back(from.channel_flags[index]);
+        index++;
+    };
+    size_t i = 0;
+    size_t j = 0;
+    while(i < timestamps.size() || j < added.timestamps.size()) {
+        if(j == added.timestamps.size())
+            take(*this, i);
+        else if(i == timestamps.size() || added.timestamps[j] > timestamps[i]
+                || (added.timestamps[j] == timestamps[i] && added.video_rowids[j] < video_rowids[i]))
+            take(added, j);
+        else
+            take(*this, i);
+    }
+
+    merged.user_flags_by_slot = std::move(added.user_flags_by_slot);
+    merged.max_rowid = added.max_rowid;
+    *this = std::move(merged);
+    return counts;
+}
+
+void VideoFlagIndex::append(sqlite3_stmt *row)
+{
+    const int slot = get_channel_slot(get_string_view(row, 0));
+    const int64_t rowid = sqlite3_column_int64(row, 3);
+    timestamps.push_back(sqlite3_column_int64(row, 2));
+    video_rowids.push_back(rowid);
+    slots.push_back(slot);
+    video_flags.push_back(sqlite3_column_int(row, 1));
+    channel_flags.push_back(user_flags_of(slot));
+    max_rowid = std::max(max_rowid, rowid);
+}
+
+void VideoFlagIndex::sort()
+{
+    std::vector<uint32_t> order(timestamps.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return timestamps[a] > timestamps[b] || (timestamps[a] == timestamps[b] && video_rowids[a] < video_rowids[b]);
+    });
+
+    const auto reorder = [&order](auto &column) {
+        std::remove_reference_t<decltype(column)> sorted;
+        sorted.reserve(column.size());
+        for(const uint32_t index: order)
+            sorted.push_back(column[index]);
+        column = std::move(sorted);
+    };
+    reorder(timestamps);
+    reorder(video_rowids);
+    reorder(slots);
+    reorder(video_flags);
+    reorder(channel_flags);
+}
+
+uint32_t VideoFlagIndex::user_flags_of(int slot) const
+{
+    return size_t(slot) < user_flags_by_slot.size() ? user_flags_by_slot[slot] : 0;
+}
+
+size_t VideoFlagIndex::position(int64_t timestamp, int64_t rowid) const
+{
+    size_t first = 0;
+    size_t last = timestamps.size();
+    while(first < last) {
+        const size_t middle = first + (last - first) / 2;
+        if(timestamps[middle] > timestamp || (timestamps[middle] == timestamp && video_rowids[middle] < rowid))
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first;
+}
+
+void VideoFlagIndex::set_flags(int64_t timestamp, int64_t rowid, int flags)
+{
+    const size_t index = position(timestamp, rowid);
+    if(index < video_rowids.size() && video_rowids[index] == rowid)
+        video_flags[index] = flags;
+}
+
+void VideoFlagIndex::set_videos_flag(const Channel &channel, VideoFlag flag, bool value)
+{
+    const Selection selected = channel.is_virtual ? select(channel.filter) : Selection();
+    for(size_t i = 0; i < video_flags.size(); i++) {
+        const bool in_channel = channel.is_virtual ? (selected[i / 64] >> (i % 64)) & 1 : slots[i] == channel.slot;
+        if(in_channel)
+            video_flags[i] = value ? video_flags[i] | flag : video_flags[i] & ~flag;
+    }
+}
+
+void VideoFlagIndex::set_user_flags(int slot, uint32_t user_flags)
+{
+    if(size_t(slot) >= user_flags_by_slot.size())
+        user_flags_by_slot.resize(slot + 1);
+    user_flags_by_slot[slot] = user_flags;
+    for(size_t i = 0; i < slots.size(); i++) {
+        if(slots[i] == slot)
+            channel_flags[i] = user_flags;
     }
+}
 
+VideoFlagIndex::Selection VideoFlagIndex::select(const ChannelFilter &filter) const
+{
+    const size_t size = video_flags.size();
+    Selection selection((size + 63) / 64, 0);
+
+    // Compares 64 videos at a time without branches, so the compiler can vectorize the inner loop.
+    const uint32_t *flags = video_flags.data();
+    const uint32_t *user_flags = channel_flags.data();
+    for(size_t word = 0; word < selection.size(); word++) {
+        const size_t first = word * 64;
+        const size_t n = std::min<size_t>(64, size - first);
+        uint64_t bits = 0;
+        for(size_t i = 0; i < n; i++) {
+            const bool match = ((flags[first + i] & filter.video_mask) == filter.video_value)
+                    & ((user_flags[first + i] & filter.user_mask) == filter.user_value);
+            bits |= uint64_t(match) << i;
+        }
+        selection[word] = bits;
+    }
+    return selection;
+}
+
+size_t VideoFlagIndex::count(const Selection &selection)
+{
+    size_t count = 0;
+    for(const uint64_t bits: selection)
+        count += __builtin_popcountll(bits);
+    return count;
+}
+
+std::vector<int64_t> VideoFlagIndex::rowids(const Selection &selection, size_t first, size_t count) const
+{
+    std::vector<int64_t> result;
+    result.reserve(count);
+
+    // Whole words are skipped by their number of set bits, only the one containing the first
+    // selected video is walked bit by bit.
+    size_t word = 0;
+    while(word < selection.size() && size_t(__builtin_popcountll(selection[word])) <= first)
+        first -= __builtin_popcountll(selection[word++]);
+    for(; word < selection.size() && result.size() < count; word++) {
+        uint64_t bits = selection[word];
+        while(bits && result.size() < count) {
+            const int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if(first > 0)
+                first--;
+            else
+                result.push_back(video_rowids[word * 64 + bit]);
+        }
+    }
+    return result;
+}
+
+size_t VideoFlagIndex::rank(const Selection &selection, int64_t timestamp, int64_t rowid) const
+{
+    const size_t end = position(timestamp, rowid);
+    size_t count = 0;
+    for(size_t word = 0; word < end / 64; word++)
+        count += __builtin_popcountll(selection[word]);
+    if(end % 64)
+        count += __builtin_popcountll(selection[end / 64] & ((uint64_t(1) << (end % 64)) - 1));
+    return count;
+}
+
+RefreshSchedule::RefreshSchedule(int64_t min_interval, int64_t max_interval): min_interval(min_interval), max_interval(std::max(min_interval, max_interval))
+{
+}
+
+void RefreshSchedule::load(sqlite3 *db, const std::vector<Channel> &channels)
+{
+    std::unordered_map<std::string, int64_t> stored;
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT flags, count(*) as videos FROM videos where channelId = ?1 GROUP by flags;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, id.c_str(), -1, SQLITE_TRANSIENT));
-    while(sqlite3_step(query) == SQLITE_ROW) {
-        const int flags = sqlite3_column_int(query, 0);
-        const int count = sqlite3_column_int(query, 1);
+    SC(db_prepare(db, "SELECT channelId, next_refresh FROM channels;", &query));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        stored.emplace(get_string(query, 0), sqlite3_column_int64(query, 1));
+    SC(db_release(query));
+
+    for(const Channel &channel: channels) {
+        if(channel.is_virtual)
+            continue;
+        const auto it = stored.find(channel.id);
+        schedule(channel, it != stored.end() ? it->second : 0);
+    }
+}
+
+std::vector<int> RefreshSchedule::take_due(int64_t now)
+{
+    std::vector<int> due;
+    while(!queue.empty() && queue.top().first <= now) {
+        const auto [time, slot] = queue.top();
+        queue.pop();
+        const auto it = due_by_slot.find(slot);
+        if(it == due_by_slot.end() || it->second != time)
+            continue;
+        due_by_slot.erase(it);
+        due.push_back(slot);
+    }
+    return due;
+}
+
+void RefreshSchedule::refreshed(sqlite3 *db, const Channel &channel, int64_t now)
+{
+    const int64_t due = now + interval(db, channel, now);
+    schedule(channel, due);
+    db_write([id = channel.id, due](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "UPDATE channels SET next_refresh = ?2 WHERE channelId = ?1;", &query));
+        SC(sqlite3_bind_text(query, 1, id.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_int64(query, 2, due));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
+}
+
+std::optional<int64_t> RefreshSchedule::next_due() const
+{
+    // Stale entries can only make this earlier, which costs an extra wakeup at most.
+    if(queue.empty())
+        return {};
+    return queue.top().first;
+}
+
+void RefreshSchedule::schedule(const Channel &channel, int64_t due)
+{
+    due_by_slot[channel.slot] = due;
+    queue.emplace(due, channel.slot);
+}
 
-        if((flags & kWatched) == 0)
-            unwatched += count;
+int64_t RefreshSchedule::interval(sqlite3 *db, const Channel &channel, int64_t now) const
+{
+    static constexpr int recent_videos = 10;
+
+    int64_t newest = 0;
+    int64_t oldest = 0;
+    int count = 0;
+    sqlite3_stmt *query;
+    SC(db_prepare(db, upload_gaps_sql, &query));
+    SC(sqlite3_bind_text(query, 1, channel.id.c_str(), -1, SQLITE_TRANSIENT));
+    SC(sqlite3_bind_int(query, 2, recent_videos));
+    if(sqlite3_step(query) == SQLITE_ROW) {
+        newest = sqlite3_column_int64(query, 0);
+        oldest = sqlite3_column_int64(query, 1);
+        count = sqlite3_column_int(query, 2);
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
+
+    if(count < 2)
+        return min_interval;
+
+    // A channel that has been quiet for longer than its usual gap is probably uploading less now.
+    const int64_t gap = std::max((newest - oldest) / (count - 1), now - newest);
+    return std::clamp(gap / 2, min_interval, max_interval);
 }
 
 bool Channel::is_valid() const
@@ -346,75 +1423,418 @@ bool Channel::is_valid() const
     return !id.empty() && !name.empty();
 }
 
-void Channel::save_user_flags(sqlite3 *db) const
+void Channel::save_user_flags(sqlite3 *) const
 {
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "UPDATE channels SET user_flags = ?2 WHERE channelID = ?1;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_int(query, 2, user_flags));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    db_write([id = id, user_flags = user_flags](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "UPDATE channels SET user_flags = ?2 WHERE channelID = ?1;", &query));
+        SC(sqlite3_bind_text(query, 1, id.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_int(query, 2, user_flags));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
+}
+
+// Turns the text typed into a search into an FTS5 query. Each word is quoted, so the text can't
+// contain query syntax. The last one matches as a prefix while it is still being typed, as far as
+// the prefix index of videos_fts reaches: longer prefixes are cut to that length. Unindexed
+// prefixes have to merge the matches of every term they cover, which took up to eight times as
+// long.
+static std::string search_match_expression(const std::string &search)
+{
+    constexpr size_t max_prefix_length = 3;
+    const bool typing_word = !search.empty() && search.back() != ' ' && search.back() != '\t';
+
+    std::string expression;
+    size_t pos = 0;
+    while((pos = search.find_first_not_of(" \t", pos)) != std::string::npos) {
+        const size_t end = std::min(search.find_first_of(" \t", pos), search.size());
+        std::string_view word(search.data() + pos, end - pos);
+        pos = end;
+
+        bool prefix = false;
+        if(typing_word && end == search.size()) {
+            // Prefix lengths are counted in characters, not bytes.
+            size_t length = 0;
+            for(size_t i = 0; i < word.size(); i++) {
+                if((word[i] & 0xc0) != 0x80 && ++length > max_prefix_length) {
+                    word = word.substr(0, i);
+                    break;
+                }
+            }
+            // A single character would match nearly everything, it is left out until the next one.
+            if(length < 2)
+                continue;
+            prefix = true;
+        }
+
+        if(!expression.empty())
+            expression.append(" ");
+        expression.append("\"");
+        for(const char c: word) {
+            if(c == '"')
+                expression.append("\"");
+            expression.append(1, c);
+        }
+        expression.append(prefix ? "\"*" : "\"");
+    }
+    return expression;
 }
 
-Video::Video(sqlite3_stmt *row): id(get_string(row, 0)), channel_id(get_string(row, 1)), title(get_string(row, 2)),
-    description(get_string(row, 3)), flags(sqlite3_column_int(row, 4)), added_to_playlist(get_string(row, 6)),
-    published(get_string(row, 5)), tui_title_width(0)
+// Lists of virtual channels are normally answered from the flag index, so their scope has no index
+// of its own. Search channels know their videos by rowid instead.
+static VideoScope video_scope(const Channel &channel)
 {
+    if(channel.is_virtual && channel.filter.user_mask)
+        return VideoScope::VideoAndUserFlags;
+    else if(channel.is_virtual)
+        return VideoScope::VideoFlags;
+    return VideoScope::Channel;
 }
 
-void Video::set_flag(sqlite3 *db, VideoFlag flag, bool value)
+static void bind_video_scope(sqlite3_stmt *query, const Channel &channel)
 {
+    if(channel.is_virtual) {
+        SC(sqlite3_bind_int(query, 1, channel.filter.video_mask));
+        SC(sqlite3_bind_int(query, 2, channel.filter.video_value));
+        if(channel.filter.user_mask) {
+            SC(sqlite3_bind_int(query, 3, channel.filter.user_mask));
+            SC(sqlite3_bind_int(query, 4, channel.filter.user_value));
+        }
+    } else {
+        SC(sqlite3_bind_text(query, 1, channel.id.c_str(), -1, SQLITE_TRANSIENT));
+    }
+}
+
+std::map<std::pair<int, int>, int> Channel::set_videos_flag(sqlite3 *db, VideoFlag flag, bool value, int64_t max_rowid) const
+{
+    std::map<std::pair<int, int>, int> changed;
     sqlite3_stmt *query;
-    if(value){
-        SC(sqlite3_prepare_v2(db, "UPDATE videos SET flags = flags | ?1 WHERE videoID = ?2;", -1, &query, nullptr));
-        flags |= flag;
+    SC(db_prepare(db, video_flag_count_sql(video_scope(*this), value).c_str(), &query));
+    bind_video_scope(query, *this);
+    SC(sqlite3_bind_int(query, 5, flag));
+    SC(sqlite3_bind_int64(query, 6, max_rowid));
+    while(sqlite3_step(query) == SQLITE_ROW)
+        changed[{get_channel_slot(get_string_view(query, 0)), sqlite3_column_int(query, 1)}] = sqlite3_column_int(query, 2);
+    SC(db_release(query));
+
+    db_write([channel = *this, flag, value](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, video_flag_update_sql(video_scope(channel), value).c_str(), &query));
+        bind_video_scope(query, channel);
+        SC(sqlite3_bind_int(query, 5, flag));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
+
+    return changed;
+}
+
+VideoId::VideoId(std::string_view id)
+{
+    chars.fill(0);
+    if(id.size() > chars.size())
+        long_id = std::make_shared<const std::string>(id);
+    else
+        std::copy(id.begin(), id.end(), chars.begin());
+}
+
+std::string VideoId::str() const
+{
+    if(long_id)
+        return *long_id;
+    return std::string(chars.data(), std::find(chars.begin(), chars.end(), 0) - chars.begin());
+}
+
+std::string_view StringArena::store(std::string_view str)
+{
+    const size_t size = str.size() + 1;
+    char *data;
+    if(size > block_size) {
+        // Oversized strings get a block of their own at the front, the last block stays the current one.
+        blocks.emplace(blocks.begin(), new char[size]);
+        data = blocks.front().get();
     } else {
-        SC(sqlite3_prepare_v2(db, "UPDATE videos SET flags = flags & ~?1 WHERE videoID = ?2;", -1, &query, nullptr));
-        flags &= ~flag;
+        if(block_used + size > block_size) {
+            blocks.emplace_back(new char[block_size]);
+            block_used = 0;
+        }
+        data = blocks.back().get() + block_used;
+        block_used += size;
     }
-    SC(sqlite3_bind_int(query, 1, flag));
-    SC(sqlite3_bind_text(query, 2, id.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    std::copy(str.begin(), str.end(), data);
+    data[str.size()] = 0;
+    return std::string_view(data, str.size());
+}
+
+Video::Video(sqlite3_stmt *row, StringArena &arena): id(get_string_view(row, 0)), channel_slot(get_channel_slot(get_string_view(row, 1))),
+    title(arena.store(get_string_view(row, 2))), flags(sqlite3_column_int(row, 3)), timestamp(sqlite3_column_int64(row, 4)),
+    rowid(sqlite3_column_int64(row, 5)), tui_title_width(0), tui_date()
+{
 }
 
-std::vector<Video> Video::get_all_for_channel(const std::string &channel_id)
+static constexpr size_t video_details_cache_size = 16;
+static std::list<std::pair<std::string, VideoDetails>> video_details_cache;
+
+const VideoDetails &Video::get_details(sqlite3 *db) const
 {
-    std::vector<Video> videos;
+    const std::string video_id = id.str();
+    const auto it = std::find_if(video_details_cache.begin(), video_details_cache.end(), [&](const auto &entry){ return entry.first == video_id; });
+    if(it != video_details_cache.end()) {
+        video_details_cache.splice(video_details_cache.begin(), video_details_cache, it);
+        return it->second;
+    }
 
+    VideoDetails details;
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT * FROM videos WHERE channelId=?1 ORDER BY coalesce(published, added_to_playlist) DESC;", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, channel_id.c_str(), -1, SQLITE_TRANSIENT));
+    SC(db_prepare(db, video_details_sql, &query));
+    SC(sqlite3_bind_text(query, 1, video_id.c_str(), -1, SQLITE_TRANSIENT));
+    if(sqlite3_step(query) == SQLITE_ROW) {
+        details.description = get_string(query, 0);
+        details.added_to_playlist = get_string(query, 1);
+        details.published = get_string(query, 2);
+    }
+    SC(db_release(query));
 
-    while(sqlite3_step(query) == SQLITE_ROW) {
-        videos.emplace_back(query);
+    video_details_cache.emplace_front(video_id, std::move(details));
+    if(video_details_cache.size() > video_details_cache_size)
+        video_details_cache.pop_back();
+    return video_details_cache.front().second;
+}
+
+bool Video::set_flag(sqlite3 *, VideoFlag flag, bool value)
+{
+    if(((flags & flag) != 0) == value)
+        return false;
+
+    if(value)
+        flags |= flag;
+    else
+        flags &= ~flag;
+
+    db_write([id = id.str(), flag, value](sqlite3 *db) {
+        sqlite3_stmt *query;
+        if(value) {
+            SC(db_prepare(db, "UPDATE videos SET flags = flags | ?1 WHERE videoID = ?2;", &query));
+        } else {
+            SC(db_prepare(db, "UPDATE videos SET flags = flags & ~?1 WHERE videoID = ?2;", &query));
+        }
+        SC(sqlite3_bind_int(query, 1, flag));
+        SC(sqlite3_bind_text(query, 2, id.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
+    return true;
+}
+
+void VideoList::reset(const Channel &channel)
+{
+    this->channel = channel;
+    reload();
+}
+
+bool VideoList::uses_flag_index() const
+{
+    return flag_index && channel && channel->is_virtual && !channel->search;
+}
+
+bool VideoList::ranks_search_results() const
+{
+    return count <= max_ranked_search_results;
+}
+
+std::vector<int64_t> VideoList::rowids(size_t first, size_t count) const
+{
+    if(uses_flag_index())
+        return flag_index->rowids(selection, first, count);
+
+    if(!ranks_search_results()) {
+        std::vector<int64_t> rowids;
+        sqlite3_stmt *query;
+        SC(db_prepare(db, search_recent_sql, &query));
+        SC(sqlite3_bind_text(query, 1, search_expression.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_int64(query, 2, count));
+        SC(sqlite3_bind_int64(query, 3, first));
+        while(sqlite3_step(query) == SQLITE_ROW)
+            rowids.push_back(sqlite3_column_int64(query, 0));
+        SC(db_release(query));
+        return rowids;
     }
-    SC(sqlite3_finalize(query));
 
-    return videos;
+    first = std::min(first, search_results.size());
+    count = std::min(count, search_results.size() - first);
+    return std::vector<int64_t>(search_results.begin() + first, search_results.begin() + first + count);
 }
 
-std::vector<Video> Video::get_all_with_filter(const ChannelFilter &filter)
+void VideoList::reload()
 {
-    std::vector<Video> videos;
+    window.clear();
+    arena = StringArena();
+    window_first = 0;
+    count = 0;
+    selection.clear();
+    search_expression.clear();
+    search_results.clear();
+    if(!channel)
+        return;
+
+    if(channel->search) {
+        search_expression = search_match_expression(*channel->search);
+        if(search_expression.empty())
+            return;
+        sqlite3_stmt *query;
+        SC(db_prepare(db, search_count_sql, &query));
+        SC(sqlite3_bind_text(query, 1, search_expression.c_str(), -1, SQLITE_TRANSIENT));
+        if(sqlite3_step(query) == SQLITE_ROW)
+            count = sqlite3_column_int64(query, 0);
+        SC(db_release(query));
+        if(count > max_ranked_search_results)
+            return;
+
+        SC(db_prepare(db, search_ranked_sql, &query));
+        SC(sqlite3_bind_text(query, 1, search_expression.c_str(), -1, SQLITE_TRANSIENT));
+        while(sqlite3_step(query) == SQLITE_ROW)
+            search_results.push_back(sqlite3_column_int64(query, 0));
+        SC(db_release(query));
+        count = search_results.size();
+        return;
+    }
+    if(uses_flag_index()) {
+        selection = flag_index->select(channel->filter);
+        count = VideoFlagIndex::count(selection);
+        return;
+    }
+    if(counter) {
+        count = counter(*channel);
+        return;
+    }
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, R"(SELECT videos.*, channels.user_flags
-                                 FROM videos JOIN channels ON videos.channelId = channels.channelId
-                                 WHERE videos.flags & ?1 = ?2
-                                   AND channels.user_flags & ?3 = ?4
-                                 ORDER BY coalesce(published, added_to_playlist) DESC;)", -1, &query, nullptr));
-    SC(sqlite3_bind_int(query, 1, filter.video_mask));
-    SC(sqlite3_bind_int(query, 2, filter.video_value));
-    SC(sqlite3_bind_int(query, 3, filter.user_mask));
-    SC(sqlite3_bind_int(query, 4, filter.user_value));
+    SC(db_prepare(db, video_count_sql(video_scope(*channel)).c_str(), &query));
+    bind_video_scope(query, *channel);
+    if(sqlite3_step(query) == SQLITE_ROW)
+        count = sqlite3_column_int64(query, 0);
+    SC(db_release(query));
+}
+
+void VideoList::load(size_t first, size_t rows)
+{
+    const size_t window_end = window_first + window.size();
+    const size_t end = std::min(count, first + rows);
+    if(!channel || (first >= window_first && end <= window_end))
+        return;
 
+    const size_t start = first > rows ? first - rows : 0;
+    const size_t wanted = std::min(count, first + 2 * rows) - start;
+
+    // Moving forward keeps the overlapping part and continues after its last video, everything
+    // else starts at a key looked up by position. Kept titles move to the arena of the new window,
+    // so the old one can be freed as a whole.
+    StringArena next_arena;
+    std::vector<Video> next;
+    next.reserve(wanted);
+    if(start >= window_first && start < window_end) {
+        next.assign(std::make_move_iterator(window.begin() + (start - window_first)), std::make_move_iterator(window.end()));
+        for(Video &video: next)
+            video.title = next_arena.store(video.title);
+    }
+
+    sqlite3_stmt *query;
+    if(uses_flag_index() || channel->search) {
+        // The flag index or search knows which videos come next, they are looked up by rowid.
+        SC(db_prepare(db, video_by_rowid_sql, &query));
+        for(const int64_t rowid: rowids(start + next.size(), wanted - next.size())) {
+            SC(sqlite3_bind_int64(query, 1, rowid));
+            if(sqlite3_step(query) == SQLITE_ROW) {
+                Video &video = next.emplace_back(query, next_arena);
+                if(prepare)
+                    prepare(video);
+            }
+            SC(sqlite3_reset(query));
+        }
+        SC(db_release(query));
+
+        window = std::move(next);
+        arena = std::move(next_arena);
+        window_first = start;
+        return;
+    }
+
+    int64_t key_timestamp = 0;
+    int64_t key_rowid = 0;
+    if(next.empty()) {
+        SC(db_prepare(db, video_position_sql(video_scope(*channel)).c_str(), &query));
+        bind_video_scope(query, *channel);
+        SC(sqlite3_bind_int64(query, 5, start));
+        const bool found = sqlite3_step(query) == SQLITE_ROW;
+        key_timestamp = sqlite3_column_int64(query, 0);
+        key_rowid = sqlite3_column_int64(query, 1);
+        SC(db_release(query));
+        if(!found) {
+            count = start;
+            window.clear();
+            arena = StringArena();
+            window_first = start;
+            return;
+        }
+    } else {
+        key_timestamp = next.back().timestamp;
+        key_rowid = next.back().rowid + 1;
+    }
+
+    SC(db_prepare(db, video_window_sql(video_scope(*channel)).c_str(), &query));
+    bind_video_scope(query, *channel);
+    SC(sqlite3_bind_int64(query, 5, key_timestamp));
+    SC(sqlite3_bind_int64(query, 6, key_rowid));
+    SC(sqlite3_bind_int64(query, 7, wanted - next.size()));
     while(sqlite3_step(query) == SQLITE_ROW) {
-        videos.emplace_back(query);
+        Video &video = next.emplace_back(query, next_arena);
+        if(prepare)
+            prepare(video);
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
+
+    // Getting fewer videos than counted means videos got removed in the meantime.
+    if(next.size() < wanted)
+        count = start + next.size();
 
-    return videos;
+    window = std::move(next);
+    arena = std::move(next_arena);
+    window_first = start;
+}
+
+Video &VideoList::at(size_t index)
+{
+    if(index < window_first || index >= window_first + window.size())
+        load(index, 64);
+    return window.at(index - window_first);
+}
+
+size_t VideoList::position(int64_t timestamp, int64_t rowid)
+{
+    if(!channel)
+        return 0;
+    if(uses_flag_index())
+        return std::min(flag_index->rank(selection, timestamp, rowid), count);
+    if(channel->search && ranks_search_results())
+        return std::find(search_results.begin(), search_results.end(), rowid) - search_results.begin();
+
+    sqlite3_stmt *query;
+    if(channel->search) {
+        SC(db_prepare(db, search_recent_rank_sql, &query));
+        SC(sqlite3_bind_text(query, 1, search_expression.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_int64(query, 2, rowid));
+    } else {
+        SC(db_prepare(db, video_rank_sql(video_scope(*channel)).c_str(), &query));
+        bind_video_scope(query, *channel);
+        SC(sqlite3_bind_int64(query, 5, timestamp));
+        SC(sqlite3_bind_int64(query, 6, rowid));
+    }
+    size_t index = 0;
+    if(sqlite3_step(query) == SQLITE_ROW)
+        index = sqlite3_column_int64(query, 0);
+    SC(db_release(query));
+    return std::min(index, count);
 }
 
 ChannelFilter::ChannelFilter(): id(-1), name(std::string()), video_mask(0), video_value(0), user_mask(0), user_value(0)
@@ -432,32 +1852,37 @@ ChannelFilter::ChannelFilter(const int id, const std::string &name): id(id), nam
 }
 
 
-void ChannelFilter::save(sqlite3 *db) const
+void ChannelFilter::save(sqlite3 *) const
 {
     if(id < 0)
         return;
 
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "UPDATE channel_filters SET name=?2, video_mask=?3, video_value=?4, user_mask=?5, user_value=?6 WHERE id = ?1;", -1, &query, nullptr));
-    SC(sqlite3_bind_int(query, 1, id));
-    SC(sqlite3_bind_text(query, 2, name.c_str(), -1, SQLITE_TRANSIENT));
-    SC(sqlite3_bind_int(query, 3, video_mask));
-    SC(sqlite3_bind_int(query, 4, video_value));
-    SC(sqlite3_bind_int(query, 5, user_mask));
-    SC(sqlite3_bind_int(query, 6, user_value));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    db_write([filter = *this](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "UPDATE channel_filters SET name=?2, video_mask=?3, video_value=?4, user_mask=?5, user_value=?6 WHERE id = ?1;", &query));
+        SC(sqlite3_bind_int(query, 1, filter.id));
+        SC(sqlite3_bind_text(query, 2, filter.name.c_str(), -1, SQLITE_TRANSIENT));
+        SC(sqlite3_bind_int(query, 3, filter.video_mask));
+        SC(sqlite3_bind_int(query, 4, filter.video_value));
+        SC(sqlite3_bind_int(query, 5, filter.user_mask));
+        SC(sqlite3_bind_int(query, 6, filter.user_value));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
+    });
 }
 
-ChannelFilter ChannelFilter::add(sqlite3 *db, const std::string &name)
+ChannelFilter ChannelFilter::add(sqlite3 *, const std::string &name)
 {
-    sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "INSERT INTO channel_filters(name) values(?1);", -1, &query, nullptr));
-    SC(sqlite3_bind_text(query, 1, name.c_str(), -1, nullptr));
-    SC(sqlite3_step(query));
-    SC(sqlite3_finalize(query));
+    int id = -1;
+    db_write_sync([&](sqlite3 *db) {
+        sqlite3_stmt *query;
+        SC(db_prepare(db, "INSERT INTO channel_filters(name) values(?1);", &query));
+        SC(sqlite3_bind_text(query, 1, name.c_str(), -1, nullptr));
+        SC(sqlite3_step(query));
+        SC(db_release(query));
 
-    int id = sqlite3_last_insert_rowid(db);
+        id = sqlite3_last_insert_rowid(db);
+    });
 
     return ChannelFilter(id, name);
 }
@@ -467,11 +1892,11 @@ std::vector<ChannelFilter> ChannelFilter::get_all(sqlite3 *db)
     std::vector<ChannelFilter> result;
 
     sqlite3_stmt *query;
-    SC(sqlite3_prepare_v2(db, "SELECT * FROM channel_filters ORDER BY id;", -1, &query, nullptr));
+    SC(db_prepare(db, "SELECT * FROM channel_filters ORDER BY id;", &query));
     while(sqlite3_step(query) == SQLITE_ROW) {
         result.emplace_back(query);
     }
-    SC(sqlite3_finalize(query));
+    SC(db_release(query));
 
     return result;
 }
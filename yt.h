@@ -1,20 +1,32 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <optional>
+#include <queue>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class sqlite3;
 class sqlite3_stmt;
-class progress_info;
+struct Video;
 
 extern struct yt_config {
     std::string api_key;
     std::map<std::string, std::string> extra_headers;
+    int refresh_concurrency = 8;
+    // Base of all API requests, the benchmarks point it at a local server.
+    std::string api_url = "https://content.googleapis.com/youtube/v3/";
 } yt_config;
 
+void yt_init();
+void yt_shutdown();
+
 class UserFlag
 {
 public:
@@ -61,48 +73,250 @@ private:
     ChannelFilter(const int id, const std::string &name);
 };
 
+// Channels are numbered densely in the order they are first seen, so per-channel data can be kept
+// in arrays and videos don't need to carry the channel id.
+int get_channel_slot(std::string_view channel_id);
+const std::string &get_channel_id(int slot);
+
 class Channel
 {
 public:
     std::string id;
+    int slot;
     std::string name;
     bool is_virtual;
     ChannelFilter filter;
+    // Set for the virtual channel of a search, its videos are the matches of this text.
+    std::optional<std::string> search;
 
     int user_flags;
 
     Channel(sqlite3_stmt *row);
     static Channel add(sqlite3 *db, const std::string &selector, const std::string &value);
     static Channel add_virtual(const std::string &name, const ChannelFilter &filter);
+    static Channel add_search(const std::string &name, const std::string &search);
     static std::vector<Channel> get_all(sqlite3 *db);
 
     std::string upload_playlist() const;
-    int fetch_new_videos(sqlite3 *db, progress_info *info=nullptr, std::optional<std::string> after={}, std::optional<int> max_count={}) const;
-    void load_info(sqlite3 *db);
+    // Refreshes several channels at once. progress gets the number of finished channels and the
+    // total, it is called regularly and cancels the refresh by returning false. errors gets why
+    // the refresh of each channel failed, or an empty string. Database errors are thrown as
+    // db_error, which callers on other threads than the main one have to pass on.
+    static std::vector<int> fetch_new_videos_parallel(sqlite3 *db, const std::vector<const Channel*> &channels, std::vector<std::string> &errors, const std::function<bool(size_t, size_t)> &progress=nullptr, std::optional<int> max_count={});
     bool is_valid() const;
 
     void save_user_flags(sqlite3 *db) const;
+    // Sets a flag on all videos of this channel, or all videos matching the filter of a virtual
+    // channel, with one UPDATE. Returns the number of changed videos per channel slot and previous
+    // flags, of those up to max_rowid. Videos added later are counted with the flags they end up
+    // with by VideoFlagIndex::update. Not for search channels.
+    std::map<std::pair<int, int>, int> set_videos_flag(sqlite3 *db, VideoFlag flag, bool value, int64_t max_rowid) const;
 
-    unsigned int unwatched;
     size_t tui_name_width;
 private:
     Channel(const std::string &id, const std::string &name);
 };
 
-struct Video
+// The number of videos per channel slot and flags. Channels and virtual channels are views on
+// these groups, so their sizes are sums over the matching groups instead of COUNT queries. The
+// application keeps them up to date as videos are added or change their flags.
+class VideoCounts
+{
+public:
+    // Counts all videos with one query.
+    void load(sqlite3 *db);
+    void add(int slot, int flags, int count=1);
+    void change_flags(int slot, int old_flags, int new_flags, int count=1);
+    // Counts the videos of a channel or the videos matching the filter of a virtual channel, of
+    // those only the ones with flags & mask == value. channels provides the user flags of the
+    // channels for virtual channels.
+    size_t count(const Channel &channel, const std::vector<Channel> &channels, uint32_t mask=0, uint32_t value=0) const;
+
+private:
+    std::vector<std::map<int, int>> groups_by_slot;
+};
+
+// The flags of all videos and the user flags of their channels, in packed columns sorted like the
+// video lists. Virtual channels are evaluated on these instead of with SQL, where the bitwise
+// filters can't use an index. The application keeps it up to date like VideoCounts.
+class VideoFlagIndex
+{
+public:
+    // One bit per video in list order, set for the videos that match.
+    using Selection = std::vector<uint64_t>;
+
+    // Loads all videos with one query. channels provides the user flags of the channels.
+    void load(sqlite3 *db, const std::vector<Channel> &channels);
+    // Adds the videos inserted since the last load or update. Returns their number per channel slot
+    // and flags, which may already differ from those of a new video.
+    std::map<std::pair<int, int>, int> update(sqlite3 *db);
+    void set_flags(int64_t timestamp, int64_t rowid, int flags);
+    // Same as Channel::set_videos_flag.
+    void set_videos_flag(const Channel &channel, VideoFlag flag, bool value=true);
+    void set_user_flags(int slot, uint32_t user_flags);
+
+    Selection select(const ChannelFilter &filter) const;
+    static size_t count(const Selection &selection);
+    // Returns the rowids of up to count selected videos, starting at the first-th one.
+    std::vector<int64_t> rowids(const Selection &selection, size_t first, size_t count) const;
+    // The highest rowid of the videos in the index.
+    int64_t last_rowid() const { return max_rowid; }
+    // Returns the number of selected videos before the one with this timestamp and rowid.
+    size_t rank(const Selection &selection, int64_t timestamp, int64_t rowid) const;
+
+private:
+    void append(sqlite3_stmt *row);
+    // Brings the videos into list order.
+    void sort();
+    uint32_t user_flags_of(int slot) const;
+    // Returns the index of the video with this timestamp and rowid, or where it would be.
+    size_t position(int64_t timestamp, int64_t rowid) const;
+
+    std::vector<int64_t> timestamps;
+    std::vector<int64_t> video_rowids;
+    std::vector<int> slots;
+    std::vector<uint32_t> video_flags;
+    std::vector<uint32_t> channel_flags;
+
+    std::vector<uint32_t> user_flags_by_slot;
+    int64_t max_rowid = 0;
+};
+
+// In-memory index of the known video ids per channel, used to find where a refresh can stop.
+// It is kept in filename between sessions if the database is large.
+void known_videos_open(sqlite3 *db, const std::string &filename);
+void known_videos_save(sqlite3 *db);
+
+// Decides when each channel is refreshed automatically, based on how often it uploads: about
+// twice per typical gap between its recent videos, within the given bounds. The next check times
+// are kept in the channels table. Times are in seconds since the epoch.
+class RefreshSchedule
+{
+public:
+    RefreshSchedule(int64_t min_interval, int64_t max_interval);
+
+    // Reads the stored check times of the given channels.
+    void load(sqlite3 *db, const std::vector<Channel> &channels);
+    // Removes the channels that are due and returns their slots. They are not scheduled again
+    // until refreshed is called for them.
+    std::vector<int> take_due(int64_t now);
+    // Schedules the next check of a channel that was just refreshed.
+    void refreshed(sqlite3 *db, const Channel &channel, int64_t now);
+    std::optional<int64_t> next_due() const;
+    void schedule(const Channel &channel, int64_t due);
+
+private:
+    int64_t interval(sqlite3 *db, const Channel &channel, int64_t now) const;
+
+    int64_t min_interval;
+    int64_t max_interval;
+    // Rescheduling leaves the old entry in the queue, entries that don't match due_by_slot are
+    // skipped.
+    std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>, std::greater<>> queue;
+    std::map<int, int64_t> due_by_slot;
+};
+
+// Parts of a video that are only needed when looking at it in detail.
+struct VideoDetails
 {
-    std::string id;
-    std::string channel_id;
-    std::string title;
     std::string description;
-    int flags;
     std::string added_to_playlist;
     std::string published;
+};
+
+// YouTube video ids are 11 characters long, so they are stored inline instead of on the heap.
+// Longer ids don't follow the usual format but are still accepted, they are kept on the heap.
+struct VideoId
+{
+    std::array<char, 11> chars;
+    std::shared_ptr<const std::string> long_id;
+
+    VideoId(std::string_view id);
+    std::string str() const;
+    bool operator==(const VideoId &other) const
+    {
+        if(long_id || other.long_id)
+            return long_id && other.long_id && *long_id == *other.long_id;
+        return chars == other.chars;
+    }
+};
+
+// Bump allocator for the strings of a video list, so loading a list needs a few large
+// allocations instead of one per string. Stored strings are NUL terminated.
+class StringArena
+{
+public:
+    std::string_view store(std::string_view str);
+
+private:
+    static constexpr size_t block_size = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_used = block_size;
+};
 
-    Video(sqlite3_stmt *row);
-    void set_flag(sqlite3 *db, VideoFlag flag, bool value=true);
-    static std::vector<Video> get_all_for_channel(const std::string &channel_id);
-    static std::vector<Video> get_all_with_filter(const ChannelFilter &filter);
+// A row of a video list. Only holds what is needed for display, see VideoDetails for the rest.
+// The title is owned by the StringArena of the list.
+struct Video
+{
+    VideoId id;
+    int channel_slot;
+    std::string_view title;
+    int flags;
+    // Unix time of the publication date, or of the date it was added to the playlist if unknown.
+    int64_t timestamp;
+    int64_t rowid;
+
+    Video(sqlite3_stmt *row, StringArena &arena);
+    // Returns whether the flag changed.
+    bool set_flag(sqlite3 *db, VideoFlag flag, bool value=true);
+    // Loads the details of this video. The last few are kept in a cache.
+    const VideoDetails &get_details(sqlite3 *db) const;
 
     size_t tui_title_width;
+    char tui_date[17];
+};
+
+// The videos of a channel, newest first. Only a window around the part that is looked at is
+// loaded. Windows are found with keyset pagination on (timestamp, rowid).
+class VideoList
+{
+public:
+    // Called for each video loaded into the window.
+    std::function<void(Video &video)> prepare;
+    // Returns the number of videos of a channel. They are counted with a query if not set.
+    std::function<size_t(const Channel &channel)> counter;
+    // Virtual channels are evaluated on this index if set. Their selection is kept until reload.
+    const VideoFlagIndex *flag_index = nullptr;
+    // Search channels rank up to this many matches by relevance. Ranking needs the score of every
+    // match, which takes too long for common words while typing, so larger results are listed
+    // most recently stored first.
+    static constexpr size_t max_ranked_search_results = 10000;
+
+    void reset(const Channel &channel);
+    // Counts the videos again and drops the loaded window.
+    void reload();
+    size_t size() const { return count; }
+    // Makes sure the videos from first to first + rows are loaded, with a margin of rows videos
+    // before and after them.
+    void load(size_t first, size_t rows);
+    Video &at(size_t index);
+    // Returns the index of the video with this timestamp and rowid, or where it would be.
+    size_t position(int64_t timestamp, int64_t rowid);
+
+private:
+    bool uses_flag_index() const;
+    bool ranks_search_results() const;
+    // Returns the rowids of the videos from first to first + count, for lists that know them.
+    std::vector<int64_t> rowids(size_t first, size_t count) const;
+
+    std::optional<Channel> channel;
+    VideoFlagIndex::Selection selection;
+    // The FTS5 query of a search channel.
+    std::string search_expression;
+    // Matches of a search channel in list order, if they are ranked.
+    std::vector<int64_t> search_results;
+    size_t count = 0;
+    size_t window_first = 0;
+    std::vector<Video> window;
+    StringArena arena;
 };
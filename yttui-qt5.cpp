@@ -18,6 +18,8 @@
 
 #include <kde_terminal_interface.h>
 
+#include <atomic>
+
 #include <unistd.h>
 #include <pty.h>
 
@@ -156,7 +158,7 @@ int main(int argc, char *argv[])
     ApplicationWindow window(term_fd);
     window.show();
 
-    bool app_quit = false;
+    std::atomic<bool> app_quit = false;
 
     AppThread appthread(app_fd);
     QObject::connect(&appthread, &AppThread::finished, [&] {
@@ -164,6 +166,7 @@ int main(int argc, char *argv[])
     });
     QObject::connect(&app, &QApplication::aboutToQuit, [&] {
         app_quit = true;
+        application_wakeup();
         appthread.wait();
     });
 